@@ -21,7 +21,9 @@
 #include "ns3/global-router-interface.h"
 #include "ns3/Radeep-global-routing.h"
 #include "ns3/Radeep-list-routing.h"
+#include "ns3/node-list.h"
 #include "ns3/log.h"
+#include <vector>
 
 namespace ns3 {
 
@@ -70,6 +72,45 @@ RadeepGlobalRoutingHelper::RecomputeRoutingTables (void)
   GlobalRouteManager::BuildGlobalRoutingDatabase ();
   GlobalRouteManager::InitializeRoutes ();
 }
+void
+RadeepGlobalRoutingHelper::UpdateRoutingTables (void)
+{
+  std::vector<Ptr<RadeepGlobalRouting> > routings;
+  for (NodeList::Iterator i = NodeList::Begin (); i != NodeList::End (); i++)
+    {
+      Ptr<GlobalRouter> router = (*i)->GetObject<GlobalRouter> ();
+      if (router == 0)
+        {
+          continue;
+        }
+      Ptr<RadeepGlobalRouting> globalRouting = router->GetRoutingProtocol ();
+      if (globalRouting == 0)
+        {
+          continue;
+        }
+      globalRouting->BeginRouteUpdate ();
+      routings.push_back (globalRouting);
+    }
+
+  // DeleteGlobalRoutes () is the only way to reset the link state database
+  // of the route manager.  The routes it removes are those of the previous
+  // tables, which RadeepGlobalRouting keeps until EndRouteUpdate () during
+  // an update.
+  GlobalRouteManager::DeleteGlobalRoutes ();
+  GlobalRouteManager::BuildGlobalRoutingDatabase ();
+  GlobalRouteManager::InitializeRoutes ();
+
+  uint32_t nChanged = 0;
+  for (std::vector<Ptr<RadeepGlobalRouting> >::iterator i = routings.begin ();
+       i != routings.end (); i++)
+    {
+      if ((*i)->EndRouteUpdate ())
+        {
+          nChanged++;
+        }
+    }
+  NS_LOG_LOGIC ("Routing tables changed on " << nChanged << " of " << routings.size () << " nodes");
+}
 
 
 } // namespace ns3
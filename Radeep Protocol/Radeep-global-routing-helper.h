@@ -65,6 +65,22 @@ public:
    *
    */
   static void RecomputeRoutingTables (void);
+  /**
+   * \brief Recompute the routes like RecomputeRoutingTables(), but only
+   * patch the routing tables where a route actually changed.
+   *
+   * The global topology database is rebuilt and the routes of every node
+   * are computed again, exactly as with RecomputeRoutingTables().  Only
+   * the churn of the routing tables is saved: every node keeps its table
+   * while the new routes are computed, routes identical to existing ones
+   * are left in place instead of being freed and allocated again, and the
+   * nodes whose table ends up unchanged do not report a routing change
+   * (so their route caches are kept).
+   * Users must first call PopulateRoutingTables().
+   *
+   * \see RadeepGlobalRouting::BeginRouteUpdate
+   */
+  static void UpdateRoutingTables (void);
 private:
   /**
    * \brief Assignment operator declared private and not implemented to disallow
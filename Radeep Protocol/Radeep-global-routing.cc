@@ -1,6 +1,7 @@
 
 
 #include <vector>
+#include <algorithm>
 #include <iomanip>
 #include "ns3/names.h"
 #include "ns3/log.h"
@@ -11,6 +12,8 @@
 #include "ns3/Radeep-route.h"
 #include "ns3/Radeep-routing-table-entry.h"
 #include "ns3/boolean.h"
+#include "ns3/uinteger.h"
+#include "ns3/Radeep-queue-disc-item.h"
 #include "ns3/node.h"
 #include "Radeep-global-routing.h"
 #include "global-route-manager.h"
@@ -25,13 +28,28 @@ TypeId
 RadeepGlobalRouting::GetTypeId (void)
 { 
   static TypeId tid = TypeId ("ns3::RadeepGlobalRouting")
-    .SetParent<Object> ()
+    .SetParent<RadeepRoutingProtocol> ()
     .SetGroupName ("Internet")
     .AddAttribute ("RandomEcmpRouting",
                    "Set to true if packets are randomly routed among ECMP; set to false for using only one route consistently",
                    BooleanValue (false),
                    MakeBooleanAccessor (&RadeepGlobalRouting::m_randomEcmpRouting),
                    MakeBooleanChecker ())
+    .AddAttribute ("FlowEcmpRouting",
+                   "Set to true if packets are routed among ECMP according to a hash of their 5-tuple, "
+                   "so that the packets of a flow always take the same path. Takes precedence over RandomEcmpRouting. "
+                   "Ports are left out for fragments, and for locally originated packets other than TCP, "
+                   "whose transport header is added after the route lookup: such flows between two hosts "
+                   "share the same path",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&RadeepGlobalRouting::m_flowEcmpRouting),
+                   MakeBooleanChecker ())
+    .AddAttribute ("FlowEcmpPerturbation",
+                   "The perturbation of the ECMP flow hash on this node. "
+                   "If zero, a random value is drawn when the protocol is initialized",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&RadeepGlobalRouting::m_flowEcmpPerturbation),
+                   MakeUintegerChecker<uint32_t> ())
     .AddAttribute ("RespondToInterfaceEvents",
                    "Set to true if you want to dynamically recompute the global routes upon Interface notification events (up/down, or add/remove address)",
                    BooleanValue (false),
@@ -43,7 +61,11 @@ RadeepGlobalRouting::GetTypeId (void)
 
 RadeepGlobalRouting::RadeepGlobalRouting () 
   : m_randomEcmpRouting (false),
-    m_respondToInterfaceEvents (false)
+    m_flowEcmpRouting (false),
+    m_flowEcmpPerturbation (0),
+    m_respondToInterfaceEvents (false),
+    m_updating (false),
+    m_routesChanged (false)
 {
   NS_LOG_FUNCTION (this);
 
@@ -61,9 +83,7 @@ RadeepGlobalRouting::AddHostRouteTo (RadeepAddress dest,
                                    uint32_t interface)
 {
   NS_LOG_FUNCTION (this << dest << nextHop << interface);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateHostRouteTo (dest, nextHop, interface);
-  m_hostRoutes.push_back (route);
+  AddHostRoute (RadeepRoutingTableEntry::CreateHostRouteTo (dest, nextHop, interface));
 }
 
 void 
@@ -71,9 +91,7 @@ RadeepGlobalRouting::AddHostRouteTo (RadeepAddress dest,
                                    uint32_t interface)
 {
   NS_LOG_FUNCTION (this << dest << interface);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateHostRouteTo (dest, interface);
-  m_hostRoutes.push_back (route);
+  AddHostRoute (RadeepRoutingTableEntry::CreateHostRouteTo (dest, interface));
 }
 
 void 
@@ -83,12 +101,11 @@ RadeepGlobalRouting::AddNetworkRouteTo (RadeepAddress network,
                                       uint32_t interface)
 {
   NS_LOG_FUNCTION (this << network << networkMask << nextHop << interface);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
-                                                        networkMask,
-                                                        nextHop,
-                                                        interface);
-  m_networkRoutes.push_back (route);
+  AddPrefixRoute (m_networkRoutes, m_networkRoutesIndex, m_nonContiguousNetworkRoutes,
+                  RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
+                                                                 networkMask,
+                                                                 nextHop,
+                                                                 interface));
 }
 
 void 
@@ -97,11 +114,10 @@ RadeepGlobalRouting::AddNetworkRouteTo (RadeepAddress network,
                                       uint32_t interface)
 {
   NS_LOG_FUNCTION (this << network << networkMask << interface);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
-                                                        networkMask,
-                                                        interface);
-  m_networkRoutes.push_back (route);
+  AddPrefixRoute (m_networkRoutes, m_networkRoutesIndex, m_nonContiguousNetworkRoutes,
+                  RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
+                                                                 networkMask,
+                                                                 interface));
 }
 
 void 
@@ -111,122 +127,498 @@ RadeepGlobalRouting::AddASExternalRouteTo (RadeepAddress network,
                                          uint32_t interface)
 {
   NS_LOG_FUNCTION (this << network << networkMask << nextHop << interface);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
-                                                        networkMask,
-                                                        nextHop,
-                                                        interface);
-  m_ASexternalRoutes.push_back (route);
+  AddPrefixRoute (m_ASexternalRoutes, m_ASexternalRoutesIndex, m_nonContiguousASExternalRoutes,
+                  RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
+                                                                 networkMask,
+                                                                 nextHop,
+                                                                 interface));
 }
 
-
-Ptr<RadeepRoute>
-RadeepGlobalRouting::LookupGlobal (RadeepAddress dest, Ptr<NetDevice> oif)
+void
+RadeepGlobalRouting::AddHostRoute (const RadeepRoutingTableEntry &entry)
 {
-  NS_LOG_FUNCTION (this << dest << oif);
-  NS_LOG_LOGIC ("Looking for route for destination " << dest);
-  Ptr<RadeepRoute> rtentry = 0;
-  // store all available routes that bring packets to their destination
-  typedef std::vector<RadeepRoutingTableEntry*> RouteVec_t;
-  RouteVec_t allRoutes;
+  NS_LOG_FUNCTION (this << entry);
+  RouteCandidates &candidates = m_hostRoutesIndex[entry.GetDest ()];
+  if (ReviveStaleRoute (candidates.begin (), candidates.end (), entry))
+    {
+      return;
+    }
+  RadeepRoutingTableEntry *route = m_routesArena.Allocate (entry);
+  m_hostRoutes.push_back (route);
+  candidates.push_back (route);
+  m_interfaceRoutes[route->GetInterface ()].insert (route);
+  PrepareEntryRoute (route);
+  m_routesChanged = true;
+  if (m_updating)
+    {
+      RecordUpdateOrder (route);
+    }
+  else
+    {
+      NotifyRoutesChanged ();
+    }
+}
 
-  NS_LOG_LOGIC ("Number of m_hostRoutes = " << m_hostRoutes.size ());
-  for (HostRoutesCI i = m_hostRoutes.begin (); 
-       i != m_hostRoutes.end (); 
-       i++) 
+void
+RadeepGlobalRouting::AddPrefixRoute (NetworkRoutes &routes, PrefixRoutesIndex &index,
+                                     NetworkRoutes &nonContiguous,
+                                     const RadeepRoutingTableEntry &entry)
+{
+  NS_LOG_FUNCTION (this << &routes << entry);
+  if (m_updating)
     {
-      NS_ASSERT ((*i)->IsHost ());
-      if ((*i)->GetDest ().IsEqual (dest)) 
+      RadeepMask mask = entry.GetDestNetworkMask ();
+      if (PrefixRoutesIndex::IsContiguous (mask))
         {
-          if (oif != 0)
+          const PrefixRoutesIndex::Bucket *matches[PrefixRoutesIndex::MAX_MATCHES];
+          uint8_t lengths[PrefixRoutesIndex::MAX_MATCHES];
+          uint32_t nMatches = index.Lookup (entry.GetDestNetwork (), matches, lengths);
+          // Longer prefixes covering the network address match too, look
+          // for the bucket of this exact prefix length
+          uint16_t prefixLength = mask.GetPrefixLength ();
+          for (uint32_t k = 0; k < nMatches && lengths[k] <= prefixLength; k++)
             {
-              if (oif != m_radeep->GetNetDevice ((*i)->GetInterface ()))
+              if (lengths[k] == prefixLength)
                 {
-                  NS_LOG_LOGIC ("Not on requested interface, skipping");
-                  continue;
+                  if (ReviveStaleRoute (matches[k]->begin (), matches[k]->end (), entry))
+                    {
+                      return;
+                    }
+                  break;
                 }
             }
-          allRoutes.push_back (*i);
-          NS_LOG_LOGIC (allRoutes.size () << "Found global host route" << *i); 
         }
+      else if (ReviveStaleRoute (nonContiguous.begin (), nonContiguous.end (), entry))
+        {
+          return;
+        }
+    }
+  RadeepRoutingTableEntry *route = m_routesArena.Allocate (entry);
+  routes.push_back (route);
+  IndexPrefixRoute (index, nonContiguous, route);
+  m_interfaceRoutes[route->GetInterface ()].insert (route);
+  PrepareEntryRoute (route);
+  m_routesChanged = true;
+  if (m_updating)
+    {
+      RecordUpdateOrder (route);
+    }
+  else
+    {
+      NotifyRoutesChanged ();
+    }
+}
+
+template <typename Iterator>
+bool
+RadeepGlobalRouting::ReviveStaleRoute (Iterator begin, Iterator end,
+                                       const RadeepRoutingTableEntry &entry)
+{
+  if (!m_updating)
+    {
+      return false;
     }
-  if (allRoutes.size () == 0) // if no host route is found
+  for (Iterator i = begin; i != end; i++)
     {
-      NS_LOG_LOGIC ("Number of m_networkRoutes" << m_networkRoutes.size ());
-      for (NetworkRoutesI j = m_networkRoutes.begin (); 
-           j != m_networkRoutes.end (); 
-           j++) 
+      if (**i == entry && m_staleRoutes.erase (*i) > 0)
         {
-          RadeepMask mask = (*j)->GetDestNetworkMask ();
-          RadeepAddress entry = (*j)->GetDestNetwork ();
-          if (mask.IsMatch (dest, entry)) 
-            {
-              if (oif != 0)
-                {
-                  if (oif != m_radeep->GetNetDevice ((*j)->GetInterface ()))
-                    {
-                      NS_LOG_LOGIC ("Not on requested interface, skipping");
-                      continue;
-                    }
-                }
-              allRoutes.push_back (*j);
-              NS_LOG_LOGIC (allRoutes.size () << "Found global network route" << *j);
-            }
+          NS_LOG_LOGIC ("Keeping unchanged route " << entry);
+          RecordUpdateOrder (*i);
+          return true;
         }
     }
-  if (allRoutes.size () == 0)  // consider external if no host/network found
+  return false;
+}
+
+void
+RadeepGlobalRouting::BeginRouteUpdate (void)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT_MSG (!m_updating, "RadeepGlobalRouting::BeginRouteUpdate (): update already in progress");
+  m_updating = true;
+  m_routesChanged = false;
+  m_updateOrder.clear ();
+  m_staleRoutes.clear ();
+  m_staleRoutes.insert (m_hostRoutes.begin (), m_hostRoutes.end ());
+  m_staleRoutes.insert (m_networkRoutes.begin (), m_networkRoutes.end ());
+  m_staleRoutes.insert (m_ASexternalRoutes.begin (), m_ASexternalRoutes.end ());
+}
+
+bool
+RadeepGlobalRouting::EndRouteUpdate (void)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT_MSG (m_updating, "RadeepGlobalRouting::EndRouteUpdate (): no update in progress");
+  if (!m_staleRoutes.empty ())
     {
-      for (ASExternalRoutesI k = m_ASexternalRoutes.begin ();
-           k != m_ASexternalRoutes.end ();
-           k++)
+      m_routesChanged = true;
+      for (HostRoutesI i = m_hostRoutes.begin (); i != m_hostRoutes.end (); )
         {
-          RadeepMask mask = (*k)->GetDestNetworkMask ();
-          RadeepAddress entry = (*k)->GetDestNetwork ();
-          if (mask.IsMatch (dest, entry))
+          if (m_staleRoutes.count (*i) > 0)
             {
-              NS_LOG_LOGIC ("Found external route" << *k);
-              if (oif != 0)
-                {
-                  if (oif != m_radeep->GetNetDevice ((*k)->GetInterface ()))
-                    {
-                      NS_LOG_LOGIC ("Not on requested interface, skipping");
-                      continue;
-                    }
-                }
-              allRoutes.push_back (*k);
-              break;
+              NS_LOG_LOGIC ("Removing stale route " << **i);
+              UnindexHostRoute (*i);
+              ReleaseRoute (*i);
+              i = m_hostRoutes.erase (i);
             }
+          else
+            {
+              i++;
+            }
+        }
+      RemoveStaleRoutes (m_networkRoutes, m_networkRoutesIndex, m_nonContiguousNetworkRoutes);
+      RemoveStaleRoutes (m_ASexternalRoutes, m_ASexternalRoutesIndex, m_nonContiguousASExternalRoutes);
+      m_staleRoutes.clear ();
+    }
+
+  // Kept routes are still at their former place: put the routes back in
+  // the order they were added by the update, as a full recomputation
+  // would, so that the ECMP candidates and the route indexes match it
+  if (SortByUpdateOrder (m_hostRoutes))
+    {
+      m_routesChanged = true;
+      m_hostRoutesIndex.clear ();
+      for (HostRoutesCI i = m_hostRoutes.begin (); i != m_hostRoutes.end (); i++)
+        {
+          m_hostRoutesIndex[(*i)->GetDest ()].push_back (*i);
         }
     }
-  if (allRoutes.size () > 0 ) // if route(s) is found
+  if (SortByUpdateOrder (m_networkRoutes))
+    {
+      m_routesChanged = true;
+      ReindexPrefixRoutes (m_networkRoutes, m_networkRoutesIndex, m_nonContiguousNetworkRoutes);
+    }
+  if (SortByUpdateOrder (m_ASexternalRoutes))
+    {
+      m_routesChanged = true;
+      ReindexPrefixRoutes (m_ASexternalRoutes, m_ASexternalRoutesIndex, m_nonContiguousASExternalRoutes);
+    }
+  m_updateOrder.clear ();
+  m_updating = false;
+  // Notify once for the whole update
+  if (m_routesChanged)
+    {
+      NotifyRoutesChanged ();
+    }
+  return m_routesChanged;
+}
+
+void
+RadeepGlobalRouting::RecordUpdateOrder (RadeepRoutingTableEntry *route)
+{
+  NS_LOG_FUNCTION (this << route);
+  uint32_t order = m_updateOrder.size ();
+  m_updateOrder[route] = order;
+}
+
+bool
+RadeepGlobalRouting::SortByUpdateOrder (NetworkRoutes &routes) const
+{
+  NS_LOG_FUNCTION (this << &routes);
+  // Once the stale routes are removed, every route was added by the update
+  UpdateOrderLess less (m_updateOrder);
+  if (std::is_sorted (routes.begin (), routes.end (), less))
     {
-      // pick up one of the routes uniformly at random if random
-      // ECMP routing is enabled, or always select the first route
-      // consistently if random ECMP routing is disabled
-      uint32_t selectIndex;
-      if (m_randomEcmpRouting)
+      return false;
+    }
+  routes.sort (less);
+  return true;
+}
+
+void
+RadeepGlobalRouting::ReindexPrefixRoutes (const NetworkRoutes &routes, PrefixRoutesIndex &index,
+                                          NetworkRoutes &nonContiguous)
+{
+  NS_LOG_FUNCTION (this << &routes);
+  index.Clear ();
+  nonContiguous.clear ();
+  for (NetworkRoutesCI i = routes.begin (); i != routes.end (); i++)
+    {
+      IndexPrefixRoute (index, nonContiguous, *i);
+    }
+}
+
+void
+RadeepGlobalRouting::RemoveStaleRoutes (NetworkRoutes &routes, PrefixRoutesIndex &index,
+                                        NetworkRoutes &nonContiguous)
+{
+  NS_LOG_FUNCTION (this << &routes);
+  for (NetworkRoutesI j = routes.begin (); j != routes.end (); )
+    {
+      if (m_staleRoutes.count (*j) > 0)
         {
-          selectIndex = m_rand->GetInteger (0, allRoutes.size ()-1);
+          NS_LOG_LOGIC ("Removing stale route " << **j);
+          UnindexPrefixRoute (index, nonContiguous, *j);
+          ReleaseRoute (*j);
+          j = routes.erase (j);
         }
-      else 
+      else
         {
-          selectIndex = 0;
+          j++;
         }
-      RadeepRoutingTableEntry* route = allRoutes.at (selectIndex); 
-      // create a RadeepRoute object from the selected routing table entry
+    }
+}
+
+void
+RadeepGlobalRouting::IndexPrefixRoute (PrefixRoutesIndex &index, NetworkRoutes &nonContiguous,
+                                       RadeepRoutingTableEntry *route)
+{
+  NS_LOG_FUNCTION (&index << &nonContiguous << route);
+  if (PrefixRoutesIndex::IsContiguous (route->GetDestNetworkMask ()))
+    {
+      index.Insert (route->GetDestNetwork (), route->GetDestNetworkMask (), route);
+    }
+  else
+    {
+      nonContiguous.push_back (route);
+    }
+}
+
+void
+RadeepGlobalRouting::UnindexPrefixRoute (PrefixRoutesIndex &index, NetworkRoutes &nonContiguous,
+                                         RadeepRoutingTableEntry *route)
+{
+  NS_LOG_FUNCTION (&index << &nonContiguous << route);
+  if (PrefixRoutesIndex::IsContiguous (route->GetDestNetworkMask ()))
+    {
+      index.Remove (route->GetDestNetwork (), route->GetDestNetworkMask (), route);
+    }
+  else
+    {
+      nonContiguous.remove (route);
+    }
+}
+
+void
+RadeepGlobalRouting::UnindexHostRoute (RadeepRoutingTableEntry *route)
+{
+  NS_LOG_FUNCTION (this << route);
+  HostRoutesIndex::iterator it = m_hostRoutesIndex.find (route->GetDest ());
+  if (it == m_hostRoutesIndex.end ())
+    {
+      return;
+    }
+  RouteCandidates &candidates = it->second;
+  candidates.erase (std::remove (candidates.begin (), candidates.end (), route), candidates.end ());
+  if (candidates.empty ())
+    {
+      m_hostRoutesIndex.erase (it);
+    }
+}
+
+Ptr<RadeepRoute>
+RadeepGlobalRouting::GetEntryRoute (RadeepRoutingTableEntry *entry)
+{
+  NS_LOG_FUNCTION (this << entry);
+  Ptr<RadeepRoute> rtentry = entry->GetRoute ();
+  if (rtentry == 0)
+    {
+      uint32_t interfaceIdx = entry->GetInterface ();
       rtentry = Create<RadeepRoute> ();
-      rtentry->SetDestination (route->GetDest ());
+      rtentry->SetDestination (entry->GetDest ());
       /// \todo handle multi-address case
-      rtentry->SetSource (m_radeep->GetAddress (route->GetInterface (), 0).GetLocal ());
-      rtentry->SetGateway (route->GetGateway ());
-      uint32_t interfaceIdx = route->GetInterface ();
+      rtentry->SetSource (m_radeep->GetAddress (interfaceIdx, 0).GetLocal ());
+      rtentry->SetGateway (entry->GetGateway ());
       rtentry->SetOutputDevice (m_radeep->GetNetDevice (interfaceIdx));
-      return rtentry;
+      entry->SetRoute (rtentry);
+    }
+  return rtentry;
+}
+
+void
+RadeepGlobalRouting::PrepareEntryRoute (RadeepRoutingTableEntry *entry)
+{
+  NS_LOG_FUNCTION (this << entry);
+  uint32_t interface = entry->GetInterface ();
+  if (m_radeep != 0 && interface < m_radeep->GetNInterfaces () && m_radeep->GetNAddresses (interface) > 0)
+    {
+      GetEntryRoute (entry);
+    }
+}
+
+void
+RadeepGlobalRouting::ResetEntryRoutes (uint32_t interface)
+{
+  NS_LOG_FUNCTION (this << interface);
+  InterfaceRoutesIndex::iterator routes = m_interfaceRoutes.find (interface);
+  if (routes == m_interfaceRoutes.end ())
+    {
+      return;
+    }
+  for (InterfaceRoutes::iterator i = routes->second.begin (); i != routes->second.end (); i++)
+    {
+      (*i)->SetRoute (0);
+    }
+  // Routes returned before hold the former source address of the interface
+  NotifyRoutesChanged ();
+}
+
+void
+RadeepGlobalRouting::ReleaseRoute (RadeepRoutingTableEntry *route)
+{
+  NS_LOG_FUNCTION (this << route);
+  InterfaceRoutesIndex::iterator routes = m_interfaceRoutes.find (route->GetInterface ());
+  if (routes != m_interfaceRoutes.end ())
+    {
+      routes->second.erase (route);
+      if (routes->second.empty ())
+        {
+          m_interfaceRoutes.erase (routes);
+        }
+    }
+  m_routesArena.Release (route);
+}
+
+bool
+RadeepGlobalRouting::IsUsable (RadeepRoutingTableEntry *route, Ptr<NetDevice> oif)
+{
+  NS_LOG_FUNCTION (this << route << oif);
+  if (oif != 0 && oif != m_radeep->GetNetDevice (route->GetInterface ()))
+    {
+      NS_LOG_LOGIC ("Not on requested interface, skipping");
+      return false;
+    }
+  return true;
+}
+
+uint32_t
+RadeepGlobalRouting::GetFlowHash (const RadeepHeader &header, Ptr<const Packet> payload) const
+{
+  NS_LOG_FUNCTION (this << header << payload);
+  if (!m_flowEcmpRouting)
+    {
+      return 0;
+    }
+  // Only the first fragment of a datagram carries the ports: leave them out
+  // of the hash of every fragment, so that all take the same path
+  if (!header.IsLastFragment () || header.GetFragmentOffset () != 0)
+    {
+      payload = 0;
+    }
+  return RadeepQueueDiscItem::FlowHash (header, payload, m_flowEcmpPerturbation);
+}
+
+RadeepRoutingTableEntry *
+RadeepGlobalRouting::SelectRoute (const RouteCandidates &candidates, Ptr<NetDevice> oif, uint32_t flowHash)
+{
+  NS_LOG_FUNCTION (this << candidates.size () << oif << flowHash);
+  uint32_t nUsable = 0;
+  for (RouteCandidates::const_iterator i = candidates.begin (); i != candidates.end (); i++)
+    {
+      if (IsUsable (*i, oif))
+        {
+          nUsable++;
+        }
+    }
+  if (nUsable == 0)
+    {
+      return 0;
+    }
+  // pick up one of the routes according to the flow hash if flow
+  // ECMP routing is enabled, uniformly at random if random ECMP
+  // routing is enabled, or always select the first route consistently
+  // otherwise
+  uint32_t selectIndex;
+  if (m_flowEcmpRouting)
+    {
+      selectIndex = flowHash % nUsable;
+    }
+  else if (m_randomEcmpRouting)
+    {
+      selectIndex = m_rand->GetInteger (0, nUsable - 1);
+    }
+  else
+    {
+      selectIndex = 0;
+    }
+  for (RouteCandidates::const_iterator i = candidates.begin (); i != candidates.end (); i++)
+    {
+      if (IsUsable (*i, oif))
+        {
+          if (selectIndex == 0)
+            {
+              return *i;
+            }
+          selectIndex--;
+        }
+    }
+  NS_ASSERT (false);
+  return 0;
+}
+
+RadeepRoutingTableEntry *
+RadeepGlobalRouting::LookupPrefix (const PrefixRoutesIndex &index,
+                                   const NetworkRoutes &nonContiguous,
+                                   RadeepAddress dest, Ptr<NetDevice> oif,
+                                   bool ecmp, uint32_t flowHash)
+{
+  NS_LOG_FUNCTION (this << &index << dest << oif << ecmp << flowHash);
+  const PrefixRoutesIndex::Bucket *matches[PrefixRoutesIndex::MAX_MATCHES];
+  uint8_t lengths[PrefixRoutesIndex::MAX_MATCHES];
+  uint32_t nMatches = index.Lookup (dest, matches, lengths);
+  for (uint32_t k = nMatches; k > 0; k--)
+    {
+      NS_LOG_LOGIC ("Checking " << matches[k - 1]->size () << " routes with mask length " << uint32_t (lengths[k - 1]));
+      if (ecmp)
+        {
+          RadeepRoutingTableEntry *route = SelectRoute (*matches[k - 1], oif, flowHash);
+          if (route != 0)
+            {
+              return route;
+            }
+          continue;
+        }
+      for (PrefixRoutesIndex::Bucket::const_iterator i = matches[k - 1]->begin ();
+           i != matches[k - 1]->end ();
+           i++)
+        {
+          if (IsUsable (*i, oif))
+            {
+              return *i;
+            }
+        }
+    }
+  for (NetworkRoutesCI i = nonContiguous.begin (); i != nonContiguous.end (); i++)
+    {
+      if ((*i)->GetDestNetworkMask ().IsMatch (dest, (*i)->GetDestNetwork ()) && IsUsable (*i, oif))
+        {
+          return *i;
+        }
+    }
+  return 0;
+}
+
+Ptr<RadeepRoute>
+RadeepGlobalRouting::LookupGlobal (RadeepAddress dest, Ptr<NetDevice> oif, uint32_t flowHash)
+{
+  NS_LOG_FUNCTION (this << dest << oif << flowHash);
+  NS_LOG_LOGIC ("Looking for route for destination " << dest);
+  RadeepRoutingTableEntry *route = 0;
+
+  NS_LOG_LOGIC ("Number of m_hostRoutes = " << m_hostRoutes.size ());
+  HostRoutesIndex::const_iterator host = m_hostRoutesIndex.find (dest);
+  if (host != m_hostRoutesIndex.end ())
+    {
+      route = SelectRoute (host->second, oif, flowHash);
+      NS_LOG_LOGIC ("Found global host route " << route);
+    }
+  if (route == 0) // if no host route is found
+    {
+      NS_LOG_LOGIC ("Number of m_networkRoutes " << m_networkRoutes.size ());
+      // ECMP candidates are the routes of the longest matching prefix
+      route = LookupPrefix (m_networkRoutesIndex, m_nonContiguousNetworkRoutes, dest, oif, true, flowHash);
+      NS_LOG_LOGIC ("Found global network route " << route);
+    }
+  if (route == 0)  // consider external if no host/network found
+    {
+      route = LookupPrefix (m_ASexternalRoutesIndex, m_nonContiguousASExternalRoutes, dest, oif, false, flowHash);
+      NS_LOG_LOGIC ("Found external route " << route);
     }
-  else 
+  if (route == 0)
     {
       return 0;
     }
+  return GetEntryRoute (route);
 }
 
 uint32_t 
@@ -302,9 +694,17 @@ RadeepGlobalRouting::RemoveRoute (uint32_t index)
         {
           if (tmp  == index)
             {
+              if (m_updating && m_staleRoutes.count (*i) > 0)
+                {
+                  NS_LOG_LOGIC ("Route " << index << " already removed by the update");
+                  return;
+                }
               NS_LOG_LOGIC ("Removing route " << index << "; size = " << m_hostRoutes.size ());
-              delete *i;
+              UnindexHostRoute (*i);
+              m_staleRoutes.erase (*i);
+              ReleaseRoute (*i);
               m_hostRoutes.erase (i);
+              NotifyRoutesChanged ();
               NS_LOG_LOGIC ("Done removing host route " << index << "; host route remaining size = " << m_hostRoutes.size ());
               return;
             }
@@ -319,9 +719,17 @@ RadeepGlobalRouting::RemoveRoute (uint32_t index)
     {
       if (tmp == index)
         {
+          if (m_updating && m_staleRoutes.count (*j) > 0)
+            {
+              NS_LOG_LOGIC ("Route " << index << " already removed by the update");
+              return;
+            }
           NS_LOG_LOGIC ("Removing route " << index << "; size = " << m_networkRoutes.size ());
-          delete *j;
+          UnindexPrefixRoute (m_networkRoutesIndex, m_nonContiguousNetworkRoutes, *j);
+          m_staleRoutes.erase (*j);
+          ReleaseRoute (*j);
           m_networkRoutes.erase (j);
+          NotifyRoutesChanged ();
           NS_LOG_LOGIC ("Done removing network route " << index << "; network route remaining size = " << m_networkRoutes.size ());
           return;
         }
@@ -335,9 +743,17 @@ RadeepGlobalRouting::RemoveRoute (uint32_t index)
     {
       if (tmp == index)
         {
+          if (m_updating && m_staleRoutes.count (*k) > 0)
+            {
+              NS_LOG_LOGIC ("Route " << index << " already removed by the update");
+              return;
+            }
           NS_LOG_LOGIC ("Removing route " << index << "; size = " << m_ASexternalRoutes.size ());
-          delete *k;
+          UnindexPrefixRoute (m_ASexternalRoutesIndex, m_nonContiguousASExternalRoutes, *k);
+          m_staleRoutes.erase (*k);
+          ReleaseRoute (*k);
           m_ASexternalRoutes.erase (k);
+          NotifyRoutesChanged ();
           NS_LOG_LOGIC ("Done removing network route " << index << "; network route remaining size = " << m_networkRoutes.size ());
           return;
         }
@@ -358,28 +774,37 @@ void
 RadeepGlobalRouting::DoDispose (void)
 {
   NS_LOG_FUNCTION (this);
-  for (HostRoutesI i = m_hostRoutes.begin (); 
-       i != m_hostRoutes.end (); 
-       i = m_hostRoutes.erase (i)) 
-    {
-      delete (*i);
-    }
-  for (NetworkRoutesI j = m_networkRoutes.begin (); 
-       j != m_networkRoutes.end (); 
-       j = m_networkRoutes.erase (j)) 
-    {
-      delete (*j);
-    }
-  for (ASExternalRoutesI l = m_ASexternalRoutes.begin (); 
-       l != m_ASexternalRoutes.end ();
-       l = m_ASexternalRoutes.erase (l))
-    {
-      delete (*l);
-    }
+  // The entries are freed block by block
+  m_hostRoutes.clear ();
+  m_networkRoutes.clear ();
+  m_ASexternalRoutes.clear ();
+  m_interfaceRoutes.clear ();
+  m_routesArena.Clear ();
+  m_hostRoutesIndex.clear ();
+  m_networkRoutesIndex.Clear ();
+  m_ASexternalRoutesIndex.Clear ();
+  m_nonContiguousNetworkRoutes.clear ();
+  m_nonContiguousASExternalRoutes.clear ();
+  m_staleRoutes.clear ();
+  m_updateOrder.clear ();
+  m_updating = false;
 
   RadeepRoutingProtocol::DoDispose ();
 }
 
+void
+RadeepGlobalRouting::DoInitialize (void)
+{
+  NS_LOG_FUNCTION (this);
+  // Draw the perturbation here rather than in the constructor, so that
+  // it follows the stream set by AssignStreams
+  if (m_flowEcmpRouting && m_flowEcmpPerturbation == 0)
+    {
+      m_flowEcmpPerturbation = m_rand->GetInteger (1, 0xffffffff);
+    }
+  RadeepRoutingProtocol::DoInitialize ();
+}
+
 // Formatted like output of "route -n" command
 void
 RadeepGlobalRouting::PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit) const
@@ -452,7 +877,15 @@ RadeepGlobalRouting::RouteOutput (Ptr<Packet> p, const RadeepHeader &header, Ptr
 // See if this is a unicast packet we have a route for.
 //
   NS_LOG_LOGIC ("Unicast destination- looking up");
-  Ptr<RadeepRoute> rtentry = LookupGlobal (header.GetDestination (), oif);
+  // TCP adds its header before asking for a route, so its ports can be
+  // hashed.  Other transports add theirs afterwards: their locally
+  // originated flows are only hashed on addresses and protocol.
+  Ptr<const Packet> payload = 0;
+  if (p != 0 && header.GetProtocol () == 6 && p->GetSize () >= 20) // minimum TCP header
+    {
+      payload = p;
+    }
+  Ptr<RadeepRoute> rtentry = LookupGlobal (header.GetDestination (), oif, GetFlowHash (header, payload));
   if (rtentry)
     {
       sockerr = Socket::ERROR_NOTERROR;
@@ -469,11 +902,18 @@ RadeepGlobalRouting::RouteInput  (Ptr<const Packet> p, const RadeepHeader &heade
                                 LocalDeliverCallback lcb, ErrorCallback ecb)
 { 
   NS_LOG_FUNCTION (this << p << header << header.GetSource () << header.GetDestination () << idev << &lcb << &ecb);
-  // Check if input device supports IP
-  NS_ASSERT (m_radeep->GetInterfaceForDevice (idev) >= 0);
-  uint32_t iif = m_radeep->GetInterfaceForDevice (idev);
+  return RouteInputWithContext (p, header, CreateInputContext (m_radeep, header, idev), ucb, mcb, lcb, ecb);
+}
+
+bool
+RadeepGlobalRouting::RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                            const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                            const LocalDeliverCallback &lcb, const ErrorCallback &ecb)
+{
+  NS_LOG_FUNCTION (this << p << header << header.GetSource () << header.GetDestination () << context.iif << &lcb << &ecb);
+  uint32_t iif = context.iif;
 
-  if (m_radeep->IsDestinationAddress (header.GetDestination (), iif))
+  if (context.isLocal)
     {
       if (!lcb.IsNull ())
         {
@@ -501,7 +941,7 @@ RadeepGlobalRouting::RouteInput  (Ptr<const Packet> p, const RadeepHeader &heade
     }
   // Next, try to find a route
   NS_LOG_LOGIC ("Unicast destination- looking up global route");
-  Ptr<RadeepRoute> rtentry = LookupGlobal (header.GetDestination ());
+  Ptr<RadeepRoute> rtentry = LookupGlobal (header.GetDestination (), 0, GetFlowHash (header, p));
   if (rtentry != 0)
     {
       NS_LOG_LOGIC ("Found unicast destination- calling unicast callback");
@@ -543,6 +983,7 @@ void
 RadeepGlobalRouting::NotifyAddAddress (uint32_t interface, RadeepInterfaceAddress address)
 {
   NS_LOG_FUNCTION (this << interface << address);
+  ResetEntryRoutes (interface);
   if (m_respondToInterfaceEvents && Simulator::Now ().GetSeconds () > 0)  // avoid startup events
     {
       GlobalRouteManager::DeleteGlobalRoutes ();
@@ -555,6 +996,7 @@ void
 RadeepGlobalRouting::NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAddress address)
 {
   NS_LOG_FUNCTION (this << interface << address);
+  ResetEntryRoutes (interface);
   if (m_respondToInterfaceEvents && Simulator::Now ().GetSeconds () > 0)  // avoid startup events
     {
       GlobalRouteManager::DeleteGlobalRoutes ();
@@ -563,6 +1005,13 @@ RadeepGlobalRouting::NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAdd
     }
 }
 
+bool
+RadeepGlobalRouting::IsRouteOutputCacheable (void) const
+{
+  // ECMP picks a route per packet or per flow, not per destination
+  return !m_randomEcmpRouting && !m_flowEcmpRouting;
+}
+
 void 
 RadeepGlobalRouting::SetRadeep (Ptr<Radeep> radeep)
 {
@@ -2,6 +2,9 @@
 #define RADEEP_GLOBAL_ROUTING_H
 
 #include <list>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <stdint.h>
 #include "ns3/Radeep-address.h"
 #include "ns3/Radeep-header.h"
@@ -9,6 +12,8 @@
 #include "ns3/Radeep.h"
 #include "ns3/Radeep-routing-protocol.h"
 #include "ns3/random-variable-stream.h"
+#include "ns3/Radeep-route-trie.h"
+#include "ns3/Radeep-route-arena.h"
 
 namespace ns3 {
 
@@ -46,6 +51,12 @@ class Node;
  *
  * This class deals with Radeep unicast routes only.
  *
+ * The routes are computed and installed serially by the GlobalRouteManager,
+ * which is not part of this module.  Installing routes is not thread safe:
+ * it fires the RoutesChanged trace source, reads the Radeep stack of the
+ * node and logs with the simulation context, so it must run in the
+ * simulation thread.
+ *
  * \see RadeepRoutingProtocol
  * \see GlobalRouteManager
  */
@@ -74,12 +85,16 @@ public:
   virtual bool RouteInput  (Ptr<const Packet> p, const RadeepHeader &header, Ptr<const NetDevice> idev,
                             UnicastForwardCallback ucb, MulticastForwardCallback mcb,
                             LocalDeliverCallback lcb, ErrorCallback ecb);
+  virtual bool RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                      const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                      const LocalDeliverCallback &lcb, const ErrorCallback &ecb);
   virtual void NotifyInterfaceUp (uint32_t interface);
   virtual void NotifyInterfaceDown (uint32_t interface);
   virtual void NotifyAddAddress (uint32_t interface, RadeepInterfaceAddress address);
   virtual void NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAddress address);
   virtual void SetRadeep (Ptr<Radeep> radeep);
   virtual void PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const;
+  virtual bool IsRouteOutputCacheable (void) const;
 
   /**
    * \brief Add a host route to the global routing table.
@@ -190,6 +205,10 @@ public:
    * default route has been set, calling RemoveRoute (0) will remove the
    * default route.
    *
+   * During an update, the routes of the previous table are already due
+   * for removal by EndRouteUpdate (): removing one of them does nothing,
+   * so that it can still be kept if the update adds it again.
+   *
    * \param i The index (into the routing table) of the route to remove.  If
    * the default route has been set, it will occupy index zero.
    *
@@ -199,6 +218,31 @@ public:
    */
   void RemoveRoute (uint32_t i);
 
+  /**
+   * \brief Start replacing the routing table with a new set of routes.
+   *
+   * Until EndRouteUpdate () is called, every route of the current table is
+   * considered stale.  The Add*RouteTo () methods then keep in place any
+   * stale route identical to the one being added, and only allocate and
+   * index the routes which are really new.  The table stays usable for
+   * lookups during the update.
+   *
+   * \see RadeepGlobalRouting::EndRouteUpdate
+   */
+  void BeginRouteUpdate (void);
+
+  /**
+   * \brief Finish an update started with BeginRouteUpdate ().
+   *
+   * The routes which were not added again since BeginRouteUpdate () are
+   * removed from the table, and the remaining routes are put in the order
+   * they were added, so that the table, its ECMP candidates and its route
+   * indexes are the ones a full recomputation would build.
+   *
+   * \return true if any route was added, removed or moved by the update
+   */
+  bool EndRouteUpdate (void);
+
   /**
    * Assign a fixed random variable stream number to the random variables
    * used by this model.  Return the number of streams (possibly zero) that
@@ -211,10 +255,15 @@ public:
 
 protected:
   void DoDispose (void);
+  void DoInitialize (void);
 
 private:
   /// Set to true if packets are randomly routed among ECMP; set to false for using only one route consistently
   bool m_randomEcmpRouting;
+  /// Set to true if packets are routed among ECMP by a hash of their 5-tuple; takes precedence over m_randomEcmpRouting
+  bool m_flowEcmpRouting;
+  /// Perturbation of the ECMP flow hash, specific to this node
+  uint32_t m_flowEcmpPerturbation;
   /// Set to true if this interface should respond to interface events by globallly recomputing routes 
   bool m_respondToInterfaceEvents;
   /// A uniform random number generator for randomly routing packets among ECMP 
@@ -241,18 +290,235 @@ private:
   /// iterator of container of RadeepRoutingTableEntry (routes to external AS)
   typedef std::list<RadeepRoutingTableEntry *>::iterator ASExternalRoutesI;
 
+  /// ECMP candidates for one destination, in insertion order
+  typedef std::vector<RadeepRoutingTableEntry *> RouteCandidates;
+  /// index of the host routes by destination address
+  typedef std::unordered_map<RadeepAddress, RouteCandidates, RadeepAddressHash> HostRoutesIndex;
+  /// index of the network or external routes by destination prefix
+  typedef RadeepRouteTrie<RadeepRoutingTableEntry *> PrefixRoutesIndex;
+  /// routes of one interface
+  typedef std::unordered_set<RadeepRoutingTableEntry *> InterfaceRoutes;
+  /// index of the routes by interface
+  typedef std::unordered_map<uint32_t, InterfaceRoutes> InterfaceRoutesIndex;
+
   /**
    * \brief Lookup in the forwarding table for destination.
    * \param dest destination address
    * \param oif output interface if any (put 0 otherwise)
+   * \param flowHash hash of the packet flow, used by flow ECMP routing
    * \return RadeepRoute to route the packet to reach dest address
    */
-  Ptr<RadeepRoute> LookupGlobal (RadeepAddress dest, Ptr<NetDevice> oif = 0);
+  Ptr<RadeepRoute> LookupGlobal (RadeepAddress dest, Ptr<NetDevice> oif = 0, uint32_t flowHash = 0);
+
+  /**
+   * \brief Compute the flow hash of a packet if flow ECMP routing is enabled.
+   *
+   * Ports are not hashed for fragments, the first one included.
+   *
+   * \param header the Radeep header of the packet
+   * \param payload the packet without the Radeep header, or 0 to ignore ports
+   * \return the flow hash, or 0 if flow ECMP routing is disabled
+   */
+  uint32_t GetFlowHash (const RadeepHeader &header, Ptr<const Packet> payload) const;
+
+  /**
+   * \brief Pick one of the ECMP candidates usable on oif.
+   * \param candidates the ECMP candidates
+   * \param oif output interface if any (put 0 otherwise)
+   * \param flowHash hash of the packet flow, used by flow ECMP routing
+   * \return the selected route, or 0 if no candidate is usable
+   */
+  RadeepRoutingTableEntry *SelectRoute (const RouteCandidates &candidates, Ptr<NetDevice> oif, uint32_t flowHash);
+
+  /**
+   * \brief Lookup the longest prefix holding a route usable on oif.
+   * \param index the prefix index to search
+   * \param nonContiguous the routes with a non-contiguous mask, searched
+   * if the index holds no usable route
+   * \param dest destination address
+   * \param oif output interface if any (put 0 otherwise)
+   * \param ecmp true to choose among all the candidates of the prefix,
+   * false to always take the first usable one
+   * \param flowHash hash of the packet flow, used by flow ECMP routing
+   * \return the selected route, or 0 if none matches
+   */
+  RadeepRoutingTableEntry *LookupPrefix (const PrefixRoutesIndex &index,
+                                         const NetworkRoutes &nonContiguous,
+                                         RadeepAddress dest, Ptr<NetDevice> oif,
+                                         bool ecmp, uint32_t flowHash);
+
+  /**
+   * \brief Check if a route can be used to send on oif.
+   * \param route the route
+   * \param oif output interface if any (put 0 otherwise)
+   * \return true if oif is null or is the route output device
+   */
+  bool IsUsable (RadeepRoutingTableEntry *route, Ptr<NetDevice> oif);
+
+  /**
+   * \brief Add a route to a prefix index.
+   * \param index the prefix index
+   * \param nonContiguous where to keep the route if its mask is not contiguous
+   * \param route the route
+   */
+  static void IndexPrefixRoute (PrefixRoutesIndex &index, NetworkRoutes &nonContiguous,
+                                RadeepRoutingTableEntry *route);
+
+  /**
+   * \brief Remove a route from a prefix index.
+   * \param index the prefix index
+   * \param nonContiguous where the route is kept if its mask is not contiguous
+   * \param route the route
+   */
+  static void UnindexPrefixRoute (PrefixRoutesIndex &index, NetworkRoutes &nonContiguous,
+                                  RadeepRoutingTableEntry *route);
+
+  /**
+   * \brief Add a host route, or keep the identical stale one during an update.
+   * \param entry the route to add
+   */
+  void AddHostRoute (const RadeepRoutingTableEntry &entry);
+
+  /**
+   * \brief Add a network or external route, or keep the identical stale one
+   * during an update.
+   * \param routes the route container
+   * \param index the prefix index of the container
+   * \param nonContiguous the routes of the container with a non-contiguous mask
+   * \param entry the route to add
+   */
+  void AddPrefixRoute (NetworkRoutes &routes, PrefixRoutesIndex &index,
+                       NetworkRoutes &nonContiguous, const RadeepRoutingTableEntry &entry);
+
+  /**
+   * \brief Look among candidate routes for a stale route identical to entry,
+   * mark it as not stale anymore and record its position in the update.
+   * \param begin the first candidate
+   * \param end past the last candidate
+   * \param entry the route being added
+   * \return true if a stale route was found
+   */
+  template <typename Iterator>
+  bool ReviveStaleRoute (Iterator begin, Iterator end, const RadeepRoutingTableEntry &entry);
+
+  /**
+   * \brief Remove the stale routes of a route container.
+   * \param routes the route container
+   * \param index the prefix index of the container
+   * \param nonContiguous the routes of the container with a non-contiguous mask
+   */
+  void RemoveStaleRoutes (NetworkRoutes &routes, PrefixRoutesIndex &index,
+                          NetworkRoutes &nonContiguous);
+
+  /**
+   * \brief Remember the position of a route added or kept by the current update.
+   * \param route the route
+   */
+  void RecordUpdateOrder (RadeepRoutingTableEntry *route);
+
+  /**
+   * \brief Sort a route container in the order the current update added
+   * its routes.
+   * \param routes the route container, without stale routes
+   * \return true if the order of the routes changed
+   */
+  bool SortByUpdateOrder (NetworkRoutes &routes) const;
+
+  /**
+   * \brief Rebuild the prefix index of a route container, following the
+   * order of the container.
+   * \param routes the route container
+   * \param index the prefix index of the container
+   * \param nonContiguous the routes of the container with a non-contiguous mask
+   */
+  static void ReindexPrefixRoutes (const NetworkRoutes &routes, PrefixRoutesIndex &index,
+                                   NetworkRoutes &nonContiguous);
+
+  /**
+   * \brief Remove a host route from the host index.
+   * \param route the route
+   */
+  void UnindexHostRoute (RadeepRoutingTableEntry *route);
+
+  /**
+   * \brief Build the route returned by the lookups matching an entry.
+   *
+   * The route is built when the entry is installed, or on first use if
+   * its interface had no address yet, and kept in the entry until the
+   * addresses of its interface change.
+   *
+   * \param entry the routing table entry
+   * \return the route
+   */
+  Ptr<RadeepRoute> GetEntryRoute (RadeepRoutingTableEntry *entry);
+
+  /**
+   * \brief Build the route of a newly installed entry, if possible.
+   * \param entry the routing table entry
+   */
+  void PrepareEntryRoute (RadeepRoutingTableEntry *entry);
+
+  /**
+   * \brief Drop the routes built for the entries of an interface, and
+   * report a routing change if there were any.
+   * \param interface the interface index
+   */
+  void ResetEntryRoutes (uint32_t interface);
+
+  /**
+   * \brief Free a route already removed from the containers and indexes,
+   * and remove it from the interface index.
+   * \param route the route
+   */
+  void ReleaseRoute (RadeepRoutingTableEntry *route);
 
   HostRoutes m_hostRoutes;             //!< Routes to hosts
   NetworkRoutes m_networkRoutes;       //!< Routes to networks
   ASExternalRoutes m_ASexternalRoutes; //!< External routes imported
 
+  HostRoutesIndex m_hostRoutesIndex;           //!< Host routes by destination
+  PrefixRoutesIndex m_networkRoutesIndex;      //!< Network routes by prefix
+  PrefixRoutesIndex m_ASexternalRoutesIndex;   //!< External routes by prefix
+  NetworkRoutes m_nonContiguousNetworkRoutes;  //!< Network routes not fitting m_networkRoutesIndex
+  ASExternalRoutes m_nonContiguousASExternalRoutes; //!< External routes not fitting m_ASexternalRoutesIndex
+
+  InterfaceRoutesIndex m_interfaceRoutes; //!< Host, network and external routes by interface
+  RadeepRouteArena<RadeepRoutingTableEntry> m_routesArena; //!< Storage of the host, network and external routes
+
+  bool m_updating;      //!< true between BeginRouteUpdate () and EndRouteUpdate ()
+  bool m_routesChanged; //!< true if the current update added or removed a route
+  std::unordered_set<RadeepRoutingTableEntry *> m_staleRoutes; //!< routes not yet added again by the current update
+  /// position of the routes added or kept by the current update, by route
+  typedef std::unordered_map<RadeepRoutingTableEntry *, uint32_t> UpdateOrder;
+  UpdateOrder m_updateOrder; //!< order in which the current update added its routes
+
+  /**
+   * \brief Compare routes by their position in the current update.
+   */
+  class UpdateOrderLess
+  {
+public:
+    /**
+     * \brief Constructor.
+     * \param order the position of the routes
+     */
+    UpdateOrderLess (const UpdateOrder &order)
+      : m_order (order)
+    {
+    }
+    /**
+     * \param a a route
+     * \param b another route
+     * \return true if a was added before b
+     */
+    bool operator() (RadeepRoutingTableEntry *a, RadeepRoutingTableEntry *b) const
+    {
+      return m_order.find (a)->second < m_order.find (b)->second;
+    }
+private:
+    const UpdateOrder &m_order; //!< position of the routes
+  };
+
   Ptr<Radeep> m_radeep; //!< associated Radeep instance
 };
 
@@ -20,6 +20,7 @@ RadeepHeader::RadeepHeader ()
     m_flags (0),
     m_fragmentOffset (0),
     m_checksum (0),
+    m_checksumValid (false),
     m_goodChecksum (true),
     m_headerSize(5*4)
 {
@@ -36,6 +37,7 @@ void
 RadeepHeader::SetPayloadSize (uint16_t size)
 {
   NS_LOG_FUNCTION (this << size);
+  m_checksumValid = false;
   m_payloadSize = size;
 }
 uint16_t
@@ -55,6 +57,7 @@ void
 RadeepHeader::SetIdentification (uint16_t identification)
 {
   NS_LOG_FUNCTION (this << identification);
+  m_checksumValid = false;
   m_identification = identification;
 }
 
@@ -62,6 +65,7 @@ void
 RadeepHeader::SetTos (uint8_t tos)
 {
   NS_LOG_FUNCTION (this << static_cast<uint32_t> (tos));
+  m_checksumValid = false;
   m_tos = tos;
 }
 
@@ -69,6 +73,7 @@ void
 RadeepHeader::SetDscp (DscpType dscp)
 {
   NS_LOG_FUNCTION (this << dscp);
+  m_checksumValid = false;
   m_tos &= 0x3; // Clear out the DSCP part, retain 2 bits of ECN
   m_tos |= (dscp << 2);
 }
@@ -77,6 +82,7 @@ void
 RadeepHeader::SetEcn (EcnType ecn)
 {
   NS_LOG_FUNCTION (this << ecn);
+  m_checksumValid = false;
   m_tos &= 0xFC; // Clear out the ECN part, retain 6 bits of DSCP
   m_tos |= ecn;
 }
@@ -180,12 +186,14 @@ void
 RadeepHeader::SetMoreFragments (void)
 {
   NS_LOG_FUNCTION (this);
+  m_checksumValid = false;
   m_flags |= MORE_FRAGMENTS;
 }
 void
 RadeepHeader::SetLastFragment (void)
 {
   NS_LOG_FUNCTION (this);
+  m_checksumValid = false;
   m_flags &= ~MORE_FRAGMENTS;
 }
 bool 
@@ -199,12 +207,14 @@ void
 RadeepHeader::SetDontFragment (void)
 {
   NS_LOG_FUNCTION (this);
+  m_checksumValid = false;
   m_flags |= DONT_FRAGMENT;
 }
 void 
 RadeepHeader::SetMayFragment (void)
 {
   NS_LOG_FUNCTION (this);
+  m_checksumValid = false;
   m_flags &= ~DONT_FRAGMENT;
 }
 bool 
@@ -218,6 +228,7 @@ void
 RadeepHeader::SetFragmentOffset (uint16_t offsetBytes)
 {
   NS_LOG_FUNCTION (this << offsetBytes);
+  m_checksumValid = false;
   // check if the user is trying to set an invalid offset
   NS_ABORT_MSG_IF ((offsetBytes & 0x7), "offsetBytes must be multiple of 8 bytes");
   m_fragmentOffset = offsetBytes;
@@ -239,8 +250,28 @@ void
 RadeepHeader::SetTtl (uint8_t ttl)
 {
   NS_LOG_FUNCTION (this << static_cast<uint32_t> (ttl));
+  m_checksumValid = false;
   m_ttl = ttl;
 }
+void
+RadeepHeader::DecrementTtl (void)
+{
+  NS_LOG_FUNCTION (this);
+  uint16_t oldWord = (m_ttl << 8) | m_protocol;
+  m_ttl--;
+  if (m_checksumValid)
+    {
+      // RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m'), with the checksum
+      // turned from its buffer byte order into network byte order
+      uint16_t newWord = (m_ttl << 8) | m_protocol;
+      uint16_t checksum = (m_checksum >> 8) | (m_checksum << 8);
+      uint32_t sum = static_cast<uint16_t> (~checksum) + static_cast<uint16_t> (~oldWord) + newWord;
+      sum = (sum & 0xffff) + (sum >> 16);
+      sum = (sum & 0xffff) + (sum >> 16);
+      checksum = ~sum;
+      m_checksum = (checksum >> 8) | (checksum << 8);
+    }
+}
 uint8_t 
 RadeepHeader::GetTtl (void) const
 {
@@ -258,6 +289,7 @@ void
 RadeepHeader::SetProtocol (uint8_t protocol)
 {
   NS_LOG_FUNCTION (this << static_cast<uint32_t> (protocol));
+  m_checksumValid = false;
   m_protocol = protocol;
 }
 
@@ -265,6 +297,7 @@ void
 RadeepHeader::SetSource (RadeepAddress source)
 {
   NS_LOG_FUNCTION (this << source);
+  m_checksumValid = false;
   m_source = source;
 }
 RadeepAddress
@@ -278,6 +311,7 @@ void
 RadeepHeader::SetDestination (RadeepAddress dst)
 {
   NS_LOG_FUNCTION (this << dst);
+  m_checksumValid = false;
   m_destination = dst;
 }
 RadeepAddress
@@ -391,8 +425,12 @@ RadeepHeader::Serialize (Buffer::Iterator start) const
 
   if (m_calcChecksum) 
     {
-      i = start;
-      uint16_t checksum = i.CalculateRadeepChecksum (20);
+      uint16_t checksum = m_checksum;
+      if (!m_checksumValid)
+        {
+          i = start;
+          checksum = i.CalculateRadeepChecksum (20);
+        }
       NS_LOG_LOGIC ("checksum=" <<checksum);
       i = start;
       i.Next (10);
@@ -450,6 +488,10 @@ RadeepHeader::Deserialize (Buffer::Iterator start)
 
       m_goodChecksum = (checksum == 0);
     }
+  // A verified checksum can be reused, and patched by DecrementTtl (), as
+  // long as no other field changes.  Options are not serialized back, so
+  // the checksum of a header with options never matches the serialized one.
+  m_checksumValid = m_calcChecksum && m_goodChecksum && headerSize == 5*4;
   return GetSerializedSize ();
 }
 
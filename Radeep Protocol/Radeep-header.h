@@ -129,6 +129,14 @@ public:
    * \param ttl the Radeep TTL
    */
   void SetTtl (uint8_t ttl);
+  /**
+   * \brief Decrement the TTL by one.
+   *
+   * If the header was deserialized with a correct checksum and has not
+   * been modified since, the checksum is updated incrementally (RFC 1624)
+   * instead of being recomputed when the header is serialized again.
+   */
+  void DecrementTtl (void);
   /**
    * \param num the Radeep protocol field
    */
@@ -238,6 +246,7 @@ private:
   RadeepAddress m_source; //!< source address
   RadeepAddress m_destination; //!< destination address
   uint16_t m_checksum; //!< checksum
+  bool m_checksumValid; //!< true if m_checksum matches the other fields
   bool m_goodChecksum; //!< true if checksum is correct
   uint16_t m_headerSize; //!< IP header size
 };
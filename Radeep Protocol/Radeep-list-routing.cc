@@ -44,6 +44,8 @@ RadeepListRouting::DoDispose (void)
       // Note:  Calling dispose on these protocols causes memory leak
       //        The routing protocols should not maintain a pointer to
       //        this object, so Dispose() shouldn't be necessary.
+      (*rprotoIter).second->TraceDisconnectWithoutContext ("RoutesChanged",
+                                                           MakeCallback (&RadeepListRouting::RoutingProtocolRoutesChanged, this));
       (*rprotoIter).second = 0;
     }
   m_routingProtocols.clear ();
@@ -112,19 +114,26 @@ RadeepListRouting::RouteInput (Ptr<const Packet> p, const RadeepHeader &header,
                              LocalDeliverCallback lcb, ErrorCallback ecb)
 {
   NS_LOG_FUNCTION (this << p << header << idev << &ucb << &mcb << &lcb << &ecb);
+  return RouteInputWithContext (p, header, CreateInputContext (m_radeep, header, idev), ucb, mcb, lcb, ecb);
+}
+
+bool
+RadeepListRouting::RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                          const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                          const LocalDeliverCallback &lcb, const ErrorCallback &ecb)
+{
+  NS_LOG_FUNCTION (this << p << header << context.iif << &ucb << &mcb << &lcb << &ecb);
   bool retVal = false;
   NS_LOG_LOGIC ("RouteInput logic for node: " << m_radeep->GetObject<Node> ()->GetId ());
 
   NS_ASSERT (m_radeep != 0);
-  // Check if input device supports Radeep 
-  NS_ASSERT (m_radeep->GetInterfaceForDevice (idev) >= 0);
-  uint32_t iif = m_radeep->GetInterfaceForDevice (idev); 
+  uint32_t iif = context.iif;
 
-  retVal = m_radeep->IsDestinationAddress (header.GetDestination (), iif);
+  retVal = context.isLocal;
   if (retVal == true)
     {
       NS_LOG_LOGIC ("Address "<< header.GetDestination () << " is a match for local delivery");
-      if (header.GetDestination ().IsMulticast ())
+      if (context.isMulticast)
         {
           Ptr<Packet> packetCopy = p->Copy ();
           lcb (packetCopy, header, iif);
@@ -157,7 +166,7 @@ RadeepListRouting::RouteInput (Ptr<const Packet> p, const RadeepHeader &header,
        rprotoIter != m_routingProtocols.end ();
        rprotoIter++)
     {
-      if ((*rprotoIter).second->RouteInput (p, header, idev, ucb, mcb, downstreamLcb, ecb))
+      if ((*rprotoIter).second->RouteInputWithContext (p, header, context, ucb, mcb, downstreamLcb, ecb))
         {
           NS_LOG_LOGIC ("Route found to forward packet in protocol " << (*rprotoIter).second->GetInstanceTypeId ().GetName ()); 
           return true;
@@ -236,6 +245,9 @@ RadeepListRouting::AddRoutingProtocol (Ptr<RadeepRoutingProtocol> routingProtoco
   NS_LOG_FUNCTION (this << routingProtocol->GetInstanceTypeId () << priority);
   m_routingProtocols.push_back (std::make_pair (priority, routingProtocol));
   m_routingProtocols.sort ( Compare );
+  routingProtocol->TraceConnectWithoutContext ("RoutesChanged",
+                                               MakeCallback (&RadeepListRouting::RoutingProtocolRoutesChanged, this));
+  NotifyRoutesChanged ();
   if (m_radeep != 0)
     {
       routingProtocol->SetRadeep (m_radeep);
@@ -270,6 +282,27 @@ RadeepListRouting::GetRoutingProtocol (uint32_t index, int16_t& priority) const
   return 0;
 }
 
+bool
+RadeepListRouting::IsRouteOutputCacheable (void) const
+{
+  for (RadeepRoutingProtocolList::const_iterator i = m_routingProtocols.begin ();
+       i != m_routingProtocols.end (); i++)
+    {
+      if (!(*i).second->IsRouteOutputCacheable ())
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+void
+RadeepListRouting::RoutingProtocolRoutesChanged (uint32_t generation)
+{
+  NS_LOG_FUNCTION (this << generation);
+  NotifyRoutesChanged ();
+}
+
 bool 
 RadeepListRouting::Compare (const RadeepRoutingProtocolEntry& a, const RadeepRoutingProtocolEntry& b)
 {
@@ -66,12 +66,16 @@ public:
   virtual bool RouteInput (Ptr<const Packet> p, const RadeepHeader &header, Ptr<const NetDevice> idev,
                            UnicastForwardCallback ucb, MulticastForwardCallback mcb,
                            LocalDeliverCallback lcb, ErrorCallback ecb);
+  virtual bool RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                      const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                      const LocalDeliverCallback &lcb, const ErrorCallback &ecb);
   virtual void NotifyInterfaceUp (uint32_t interface);
   virtual void NotifyInterfaceDown (uint32_t interface);
   virtual void NotifyAddAddress (uint32_t interface, RadeepInterfaceAddress address);
   virtual void NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAddress address);
   virtual void SetRadeep (Ptr<Radeep> radeep);
   virtual void PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const;
+  virtual bool IsRouteOutputCacheable (void) const;
 
 protected:
   virtual void DoDispose (void);
@@ -94,6 +98,12 @@ private:
    * \return true if they are the same, false otherwise
    */
   static bool Compare (const RadeepRoutingProtocolEntry& a, const RadeepRoutingProtocolEntry& b);
+
+  /**
+   * \brief Propagate a routing table change of one of the protocols.
+   * \param generation the new generation of the protocol
+   */
+  void RoutingProtocolRoutesChanged (uint32_t generation);
   Ptr<Radeep> m_radeep; //!< Radeep this protocol is associated with.
 
 
@@ -97,26 +97,33 @@ uint32_t
 RadeepQueueDiscItem::Hash (uint32_t perturbation) const
 {
   NS_LOG_FUNCTION (this << perturbation);
+  return FlowHash (m_header, GetPacket (), perturbation);
+}
+
+uint32_t
+RadeepQueueDiscItem::FlowHash (const RadeepHeader &header, Ptr<const Packet> payload, uint32_t perturbation)
+{
+  NS_LOG_FUNCTION (header << payload << perturbation);
 
-  RadeepAddress src = m_header.GetSource ();
-  RadeepAddress dest = m_header.GetDestination ();
-  uint8_t prot = m_header.GetProtocol ();
-  uint16_t fragOffset = m_header.GetFragmentOffset ();
+  RadeepAddress src = header.GetSource ();
+  RadeepAddress dest = header.GetDestination ();
+  uint8_t prot = header.GetProtocol ();
+  uint16_t fragOffset = header.GetFragmentOffset ();
 
   TcpHeader tcpHdr;
   UdpHeader udpHdr;
   uint16_t srcPort = 0;
   uint16_t destPort = 0;
 
-  if (prot == 6 && fragOffset == 0) // TCP
+  if (payload != 0 && prot == 6 && fragOffset == 0) // TCP
     {
-      GetPacket ()->PeekHeader (tcpHdr);
+      payload->PeekHeader (tcpHdr);
       srcPort = tcpHdr.GetSourcePort ();
       destPort = tcpHdr.GetDestinationPort ();
     }
-  else if (prot == 17 && fragOffset == 0) // UDP
+  else if (payload != 0 && prot == 17 && fragOffset == 0) // UDP
     {
-      GetPacket ()->PeekHeader (udpHdr);
+      payload->PeekHeader (udpHdr);
       srcPort = udpHdr.GetSourcePort ();
       destPort = udpHdr.GetDestinationPort ();
     }
@@ -76,6 +76,21 @@ public:
    */
   virtual uint32_t Hash (uint32_t perturbation) const;
 
+  /**
+   * \brief Computes the hash of a packet's 5-tuple
+   *
+   * This is the flow key used by Hash, made available to the components
+   * that need to classify packets whose header is not stored in a queue
+   * disc item (e.g., to select among equal cost routes).  Ports are only
+   * included if the payload is given and starts with a UDP or TCP header.
+   *
+   * \param header the Radeep header of the packet
+   * \param payload the packet without the Radeep header, or 0 to ignore ports
+   * \param perturbation hash perturbation value
+   * \return the hash of the packet's 5-tuple
+   */
+  static uint32_t FlowHash (const RadeepHeader &header, Ptr<const Packet> payload, uint32_t perturbation);
+
 private:
   /**
    * \brief Default constructor
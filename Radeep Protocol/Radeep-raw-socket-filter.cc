@@ -0,0 +1,188 @@
+#include <algorithm>
+#include "Radeep-raw-socket-filter.h"
+#include "ns3/packet.h"
+#include "ns3/assert.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("RadeepRawSocketFilter");
+
+RadeepRawSocketFilter::Instruction
+RadeepRawSocketFilter::Statement (enum Opcode code, uint32_t k)
+{
+  return Jump (code, k, 0, 0);
+}
+
+RadeepRawSocketFilter::Instruction
+RadeepRawSocketFilter::Jump (enum Opcode code, uint32_t k, uint8_t jt, uint8_t jf)
+{
+  Instruction instruction;
+  instruction.code = code;
+  instruction.jt = jt;
+  instruction.jf = jf;
+  instruction.k = k;
+  return instruction;
+}
+
+RadeepRawSocketFilter::RadeepRawSocketFilter ()
+  : m_payloadBytes (0)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+bool
+RadeepRawSocketFilter::Compile (const std::vector<Instruction> &program)
+{
+  NS_LOG_FUNCTION (this << program.size ());
+  if (program.empty () || program.back ().code != RET)
+    {
+      NS_LOG_WARN ("Filter program does not end with RET");
+      return false;
+    }
+  uint32_t payloadBytes = 0;
+  for (uint32_t pc = 0; pc < program.size (); pc++)
+    {
+      const Instruction &instruction = program[pc];
+      uint32_t size = 0;
+      switch (instruction.code)
+        {
+        case LD_PROTOCOL:
+        case LD_SOURCE:
+        case LD_DESTINATION:
+        case LD_TOS:
+        case LD_TTL:
+        case LD_LENGTH:
+        case AND:
+        case RET:
+          break;
+        case LD_PAYLOAD_B:
+          size = 1;
+          break;
+        case LD_PAYLOAD_H:
+          size = 2;
+          break;
+        case LD_PAYLOAD_W:
+          size = 4;
+          break;
+        case JEQ:
+        case JGT:
+        case JGE:
+        case JSET:
+          // The last instruction is a RET, so a jump landing before the end
+          // always reaches a RET
+          if (pc + 1 + instruction.jt >= program.size ()
+              || pc + 1 + instruction.jf >= program.size ())
+            {
+              NS_LOG_WARN ("Filter jump out of the program at " << pc);
+              return false;
+            }
+          break;
+        default:
+          NS_LOG_WARN ("Unknown filter instruction at " << pc);
+          return false;
+        }
+      if (size != 0)
+        {
+          if (instruction.k > MAX_PAYLOAD_BYTES - size)
+            {
+              NS_LOG_WARN ("Filter payload read out of range at " << pc);
+              return false;
+            }
+          payloadBytes = std::max (payloadBytes, instruction.k + size);
+        }
+    }
+  m_program = program;
+  m_payloadBytes = payloadBytes;
+  return true;
+}
+
+bool
+RadeepRawSocketFilter::IsValid (void) const
+{
+  return !m_program.empty ();
+}
+
+bool
+RadeepRawSocketFilter::Match (Ptr<const Packet> p, const RadeepHeader &header) const
+{
+  NS_LOG_FUNCTION (this << p << header);
+  if (m_program.empty ())
+    {
+      return true;
+    }
+  // Only the prefix read by the program is copied, and only if it is read
+  uint8_t payload[MAX_PAYLOAD_BYTES];
+  uint32_t available = 0;
+  bool loaded = false;
+  uint32_t a = 0;
+  for (uint32_t pc = 0; pc < m_program.size (); pc++)
+    {
+      const Instruction &instruction = m_program[pc];
+      switch (instruction.code)
+        {
+        case LD_PROTOCOL:
+          a = header.GetProtocol ();
+          break;
+        case LD_SOURCE:
+          a = header.GetSource ().Get ();
+          break;
+        case LD_DESTINATION:
+          a = header.GetDestination ().Get ();
+          break;
+        case LD_TOS:
+          a = header.GetTos ();
+          break;
+        case LD_TTL:
+          a = header.GetTtl ();
+          break;
+        case LD_LENGTH:
+          a = p->GetSize ();
+          break;
+        case LD_PAYLOAD_B:
+        case LD_PAYLOAD_H:
+        case LD_PAYLOAD_W:
+          {
+            if (!loaded)
+              {
+                available = p->CopyData (payload, m_payloadBytes);
+                loaded = true;
+              }
+            uint32_t size = (instruction.code == LD_PAYLOAD_B) ? 1 :
+              (instruction.code == LD_PAYLOAD_H) ? 2 : 4;
+            if (instruction.k + size > available)
+              {
+                return false;
+              }
+            a = 0;
+            for (uint32_t i = 0; i < size; i++)
+              {
+                a = (a << 8) | payload[instruction.k + i];
+              }
+            break;
+          }
+        case AND:
+          a &= instruction.k;
+          break;
+        case JEQ:
+          pc += (a == instruction.k) ? instruction.jt : instruction.jf;
+          break;
+        case JGT:
+          pc += (a > instruction.k) ? instruction.jt : instruction.jf;
+          break;
+        case JGE:
+          pc += (a >= instruction.k) ? instruction.jt : instruction.jf;
+          break;
+        case JSET:
+          pc += (a & instruction.k) ? instruction.jt : instruction.jf;
+          break;
+        case RET:
+          return instruction.k != 0;
+        }
+    }
+  // Compile () makes sure every program ends with a RET
+  NS_ASSERT_MSG (false, "Filter program ran past its end");
+  return false;
+}
+
+} // namespace ns3
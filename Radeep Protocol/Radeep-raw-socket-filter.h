@@ -0,0 +1,129 @@
+#ifndef RADEEP_RAW_SOCKET_FILTER_H
+#define RADEEP_RAW_SOCKET_FILTER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "ns3/simple-ref-count.h"
+#include "ns3/ptr.h"
+#include "ns3/Radeep-header.h"
+
+namespace ns3 {
+
+class Packet;
+
+/**
+ * \ingroup socket
+ *
+ * \brief Compiled packet filter for raw Radeep sockets.
+ *
+ * A filter is a small program in the spirit of the BSD packet filter.
+ * It runs on a single 32-bit accumulator and can read the fields of the
+ * Radeep header and the first bytes of the payload.  The program ends
+ * with a RET instruction that accepts or rejects the packet.  Jumps
+ * only go forward, so every program terminates.
+ *
+ * For instance, to accept only ICMP echo requests:
+ * \code
+ *   std::vector<RadeepRawSocketFilter::Instruction> program;
+ *   program.push_back (RadeepRawSocketFilter::Statement (RadeepRawSocketFilter::LD_PAYLOAD_B, 0));
+ *   program.push_back (RadeepRawSocketFilter::Jump (RadeepRawSocketFilter::JEQ, 8, 0, 1));
+ *   program.push_back (RadeepRawSocketFilter::Statement (RadeepRawSocketFilter::RET, 1));
+ *   program.push_back (RadeepRawSocketFilter::Statement (RadeepRawSocketFilter::RET, 0));
+ * \endcode
+ *
+ * Programs are checked once by Compile (), so that Match () does not
+ * have to check them for each packet.
+ */
+class RadeepRawSocketFilter : public SimpleRefCount<RadeepRawSocketFilter>
+{
+public:
+  /// Number of payload bytes a program can read
+  static const uint32_t MAX_PAYLOAD_BYTES = 64;
+
+  /// Instruction codes, A is the accumulator
+  enum Opcode
+  {
+    LD_PROTOCOL,    //!< A = protocol
+    LD_SOURCE,      //!< A = source address
+    LD_DESTINATION, //!< A = destination address
+    LD_TOS,         //!< A = type of service
+    LD_TTL,         //!< A = time to live
+    LD_LENGTH,      //!< A = payload length
+    LD_PAYLOAD_B,   //!< A = payload byte at offset k
+    LD_PAYLOAD_H,   //!< A = payload 16-bit word at offset k, in network order
+    LD_PAYLOAD_W,   //!< A = payload 32-bit word at offset k, in network order
+    AND,            //!< A = A & k
+    JEQ,            //!< skip jt instructions if A == k, jf otherwise
+    JGT,            //!< skip jt instructions if A > k, jf otherwise
+    JGE,            //!< skip jt instructions if A >= k, jf otherwise
+    JSET,           //!< skip jt instructions if A & k, jf otherwise
+    RET             //!< accept the packet if k is not 0, reject it otherwise
+  };
+
+  /// A filter instruction
+  struct Instruction
+  {
+    uint8_t code; //!< instruction code, an Opcode
+    uint8_t jt;   //!< instructions to skip if the condition is true
+    uint8_t jf;   //!< instructions to skip if the condition is false
+    uint32_t k;   //!< constant operand
+  };
+
+  /**
+   * \brief Build an instruction other than a jump.
+   * \param code the instruction code
+   * \param k the constant operand
+   * \return the instruction
+   */
+  static Instruction Statement (enum Opcode code, uint32_t k);
+
+  /**
+   * \brief Build a conditional jump.
+   * \param code the instruction code
+   * \param k the constant operand
+   * \param jt instructions to skip if the condition is true
+   * \param jf instructions to skip if the condition is false
+   * \return the instruction
+   */
+  static Instruction Jump (enum Opcode code, uint32_t k, uint8_t jt, uint8_t jf);
+
+  RadeepRawSocketFilter ();
+
+  /**
+   * \brief Check a program and make it the program of the filter.
+   *
+   * The program is rejected if it is empty, holds unknown instructions,
+   * jumps past its end, reads more than MAX_PAYLOAD_BYTES of payload, or
+   * can reach its end without a RET.  The previous program is then kept.
+   *
+   * \param program the program
+   * \return true if the program was accepted
+   */
+  bool Compile (const std::vector<Instruction> &program);
+
+  /**
+   * \return true if the filter holds a program
+   */
+  bool IsValid (void) const;
+
+  /**
+   * \brief Run the program on a packet.
+   *
+   * Payload reads past the end of the packet reject the packet.  A filter
+   * without program accepts everything.
+   *
+   * \param p the packet, without its Radeep header
+   * \param header the Radeep header of the packet
+   * \return true if the packet is accepted
+   */
+  bool Match (Ptr<const Packet> p, const RadeepHeader &header) const;
+
+private:
+  std::vector<Instruction> m_program; //!< the checked program
+  uint32_t m_payloadBytes;            //!< payload bytes read by the program
+};
+
+} // namespace ns3
+
+#endif /* RADEEP_RAW_SOCKET_FILTER_H */
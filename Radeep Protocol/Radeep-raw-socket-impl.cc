@@ -4,13 +4,13 @@
 #include <sys/types.h>
 #include "Radeep-raw-socket-impl.h"
 #include "radeep-l3-protocol.h"
-#include "icmpv4.h"
 #include "ns3/Radeep-packet-info-tag.h"
 #include "ns3/inet-socket-address.h"
 #include "ns3/node.h"
 #include "ns3/packet.h"
 #include "ns3/uinteger.h"
 #include "ns3/boolean.h"
+#include "ns3/trace-source-accessor.h"
 #include "ns3/log.h"
 
 namespace ns3 {
@@ -27,7 +27,8 @@ RadeepRawSocketImpl::GetTypeId (void)
     .SetGroupName ("Internet")
     .AddAttribute ("Protocol", "Protocol number to match.",
                    UintegerValue (0),
-                   MakeUintegerAccessor (&RadeepRawSocketImpl::m_protocol),
+                   MakeUintegerAccessor (&RadeepRawSocketImpl::SetProtocol,
+                                         &RadeepRawSocketImpl::GetProtocol),
                    MakeUintegerChecker<uint16_t> ())
     .AddAttribute ("IcmpFilter", 
                    "Any icmp header whose type field matches a bit in this filter is dropped. Type must be less than 32.",
@@ -47,6 +48,26 @@ RadeepRawSocketImpl::GetTypeId (void)
                    BooleanValue (false),
                    MakeBooleanAccessor (&RadeepRawSocketImpl::m_Radeephdrincl),
                    MakeBooleanChecker ())
+    .AddAttribute ("RcvBufSize",
+                   "RadeepRawSocket maximum receive buffer size (bytes)",
+                   UintegerValue (131072),
+                   MakeUintegerAccessor (&RadeepRawSocketImpl::m_rcvBufSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("RcvBufPackets",
+                   "RadeepRawSocket maximum number of packets in the receive buffer",
+                   UintegerValue (128),
+                   MakeUintegerAccessor (&RadeepRawSocketImpl::m_rcvBufPackets),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("RecvNotifyBatch",
+                   "Notify the receive callback only when a packet arrives in an empty receive queue. "
+                   "The application is then expected to drain the queue, e.g. with RecvBatch.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&RadeepRawSocketImpl::m_recvNotifyBatch),
+                   MakeBooleanChecker ())
+    .AddTraceSource ("Drop",
+                     "Drop RadeepRawSocket packet due to receive buffer overflow",
+                     MakeTraceSourceAccessor (&RadeepRawSocketImpl::m_dropTrace),
+                     "ns3::Packet::TracedCallback")
   ;
   return tid;
 }
@@ -61,6 +82,11 @@ RadeepRawSocketImpl::RadeepRawSocketImpl ()
   m_protocol = 0;
   m_shutdownSend = false;
   m_shutdownRecv = false;
+  m_recvHead = 0;
+  m_recvCount = 0;
+  m_rxAvailable = 0;
+  m_rxDrops = 0;
+  m_recvNotifyBatch = false;
 }
 
 void 
@@ -75,6 +101,11 @@ RadeepRawSocketImpl::DoDispose (void)
 {
   NS_LOG_FUNCTION (this);
   m_node = 0;
+  m_filter = 0;
+  m_recv.clear ();
+  m_recvHead = 0;
+  m_recvCount = 0;
+  m_rxAvailable = 0;
   Socket::DoDispose ();
 }
 
@@ -228,28 +259,7 @@ RadeepRawSocketImpl::SendTo (Ptr<Packet> p, uint32_t flags,
   RadeepAddress src = m_src;
   uint8_t tos = ad.GetTos ();
 
-  uint8_t priority = GetPriority ();
-  if (tos)
-    {
-      SocketRadeepTosTag RadeepTosTag;
-      RadeepTosTag.SetTos (tos);
-      // This packet may already have a SocketRadeepTosTag (see BUG 2440)
-      p->ReplacePacketTag (RadeepTosTag);
-      priority = RadeepTos2Priority (tos);
-    }
-  if (priority)
-    {
-      SocketPriorityTag priorityTag;
-      priorityTag.SetPriority (priority);
-      p->ReplacePacketTag (priorityTag);
-    }
-
-  if (IsManualRadeepTtl () && GetRadeepTtl () != 0 && !dst.IsMulticast () && !dst.IsBroadcast ())
-    {
-      SocketRadeepTtlTag tag;
-      tag.SetTtl (GetRadeepTtl ());
-      p->AddPacketTag (tag);
-    }
+  AddSendTags (p, dst, tos);
 
   bool subnetDirectedBroadcast = false;
   if (m_boundnetdevice)
@@ -323,18 +333,7 @@ RadeepRawSocketImpl::SendTo (Ptr<Packet> p, uint32_t flags,
           src = header.GetSource ();
         }
       SocketErrno errno_ = ERROR_NOTERROR; //do not use errno as it is the standard C last error number
-      Ptr<RadeepRoute> route;
-      Ptr<NetDevice> oif = m_boundnetdevice; //specify non-zero if bound to a source address
-      if (!oif && src != RadeepAddress::GetAny ())
-        {
-          int32_t index = radeep->GetInterfaceForAddress (src);
-          NS_ASSERT (index >= 0);
-          oif = radeep->GetNetDevice (index);
-          NS_LOG_LOGIC ("Set index " << oif << "from source " << src);
-        }
-
-      // TBD-- we could cache the route and just check its validity
-      route = radeep->GetRoutingProtocol ()->RouteOutput (p, header, oif, errno_);
+      Ptr<RadeepRoute> route = FindRoute (radeep, p, header, src, errno_);
       if (route != 0)
         {
           NS_LOG_LOGIC ("Route exists");
@@ -360,16 +359,125 @@ RadeepRawSocketImpl::SendTo (Ptr<Packet> p, uint32_t flags,
     }
   return 0;
 }
+int
+RadeepRawSocketImpl::SendBatch (const std::vector<Ptr<Packet> > &packets, uint32_t flags,
+                                const Address &toAddress)
+{
+  NS_LOG_FUNCTION (this << packets.size () << flags << toAddress);
+  if (!InetSocketAddress::IsMatchingType (toAddress))
+    {
+      m_err = Socket::ERROR_INVAL;
+      return -1;
+    }
+  if (m_shutdownSend || packets.empty ())
+    {
+      return 0;
+    }
+
+  InetSocketAddress ad = InetSocketAddress::ConvertFrom (toAddress);
+  Ptr<Radeep> radeep = m_node->GetObject<Radeep> ();
+  RadeepAddress dst = ad.GetRadeep ();
+  uint8_t tos = ad.GetTos ();
+
+  // Packets carrying their own header and broadcasts (which bound sockets
+  // detect per interface) are not sent on a shared route
+  if (m_Radeephdrincl || m_boundnetdevice || dst.IsBroadcast ()
+      || !radeep->GetRoutingProtocol ())
+    {
+      int sent = 0;
+      for (std::vector<Ptr<Packet> >::const_iterator i = packets.begin (); i != packets.end (); i++)
+        {
+          if (SendTo (*i, flags, toAddress) < 0)
+            {
+              break;
+            }
+          sent++;
+        }
+      return sent > 0 ? sent : -1;
+    }
+
+  RadeepHeader header;
+  header.SetDestination (dst);
+  header.SetProtocol (m_protocol);
+  SocketErrno errno_ = ERROR_NOTERROR;
+  // All the packets go to the same destination: the first one stands for
+  // the batch in the route lookup
+  Ptr<RadeepRoute> route = FindRoute (radeep, packets.front (), header, m_src, errno_);
+  if (route == 0)
+    {
+      NS_LOG_DEBUG ("dropped because no outgoing route.");
+      m_err = errno_;
+      return -1;
+    }
+
+  uint32_t batchSize = 0;
+  for (std::vector<Ptr<Packet> >::const_iterator i = packets.begin (); i != packets.end (); i++)
+    {
+      Ptr<Packet> p = *i;
+      AddSendTags (p, dst, tos);
+      batchSize += p->GetSize ();
+      radeep->Send (p, route->GetSource (), dst, m_protocol, route);
+    }
+  NotifyDataSent (batchSize);
+  NotifySend (GetTxAvailable ());
+  return packets.size ();
+}
+
+void
+RadeepRawSocketImpl::AddSendTags (Ptr<Packet> p, RadeepAddress dst, uint8_t tos)
+{
+  NS_LOG_FUNCTION (this << p << dst << static_cast<uint32_t> (tos));
+  uint8_t priority = GetPriority ();
+  if (tos)
+    {
+      SocketRadeepTosTag RadeepTosTag;
+      RadeepTosTag.SetTos (tos);
+      // This packet may already have a SocketRadeepTosTag (see BUG 2440)
+      p->ReplacePacketTag (RadeepTosTag);
+      priority = RadeepTos2Priority (tos);
+    }
+  if (priority)
+    {
+      SocketPriorityTag priorityTag;
+      priorityTag.SetPriority (priority);
+      p->ReplacePacketTag (priorityTag);
+    }
+
+  if (IsManualRadeepTtl () && GetRadeepTtl () != 0 && !dst.IsMulticast () && !dst.IsBroadcast ())
+    {
+      SocketRadeepTtlTag tag;
+      tag.SetTtl (GetRadeepTtl ());
+      p->AddPacketTag (tag);
+    }
+}
+
+Ptr<RadeepRoute>
+RadeepRawSocketImpl::FindRoute (Ptr<Radeep> radeep, Ptr<Packet> p, const RadeepHeader &header,
+                                RadeepAddress src, Socket::SocketErrno &errno_)
+{
+  NS_LOG_FUNCTION (this << radeep << p << header << src);
+  Ptr<NetDevice> oif = m_boundnetdevice; //specify non-zero if bound to a source address
+  if (!oif && src != RadeepAddress::GetAny ())
+    {
+      int32_t index = radeep->GetInterfaceForAddress (src);
+      NS_ASSERT (index >= 0);
+      oif = radeep->GetNetDevice (index);
+      NS_LOG_LOGIC ("Set index " << oif << "from source " << src);
+    }
+
+  Ptr<RadeepL3Protocol> radeepL3 = radeep->GetObject<RadeepL3Protocol> ();
+  if (radeepL3 != 0)
+    {
+      return radeepL3->CachedRouteOutput (p, header, oif, errno_);
+    }
+  return radeep->GetRoutingProtocol ()->RouteOutput (p, header, oif, errno_);
+}
+
 uint32_t 
 RadeepRawSocketImpl::GetRxAvailable (void) const
 {
   NS_LOG_FUNCTION (this);
-  uint32_t rx = 0;
-  for (std::list<Data>::const_iterator i = m_recv.begin (); i != m_recv.end (); ++i)
-    {
-      rx += (i->packet)->GetSize ();
-    }
-  return rx;
+  return m_rxAvailable;
 }
 Ptr<Packet> 
 RadeepRawSocketImpl::Recv (uint32_t maxSize, uint32_t flags)
@@ -383,12 +491,12 @@ RadeepRawSocketImpl::RecvFrom (uint32_t maxSize, uint32_t flags,
                              Address &fromAddress)
 {
   NS_LOG_FUNCTION (this << maxSize << flags << fromAddress);
-  if (m_recv.empty ())
+  if (m_recvCount == 0)
     {
       return 0;
     }
-  struct Data data = m_recv.front ();
-  m_recv.pop_front ();
+  // Work on the slot in place, the head stays queued on a partial read
+  struct Data &data = m_recv[m_recvHead];
   InetSocketAddress inet = InetSocketAddress (data.fromRadeep, data.fromProtocol);
   fromAddress = inet;
   if (data.packet->GetSize () > maxSize)
@@ -397,18 +505,108 @@ RadeepRawSocketImpl::RecvFrom (uint32_t maxSize, uint32_t flags,
       if (!(flags & MSG_PEEK))
         {
           data.packet->RemoveAtStart (maxSize);
+          m_rxAvailable -= maxSize;
         }
-      m_recv.push_front (data);
       return first;
     }
-  return data.packet;
+  Ptr<Packet> packet = data.packet;
+  PopRecv ();
+  return packet;
+}
+
+uint32_t
+RadeepRawSocketImpl::RecvBatch (std::vector<Ptr<Packet> > &packets,
+                                std::vector<Address> &fromAddresses,
+                                uint32_t maxPackets)
+{
+  NS_LOG_FUNCTION (this << maxPackets);
+  uint32_t received = 0;
+  while (received < maxPackets && m_recvCount > 0)
+    {
+      const struct Data &data = m_recv[m_recvHead];
+      packets.push_back (data.packet);
+      fromAddresses.push_back (InetSocketAddress (data.fromRadeep, data.fromProtocol));
+      PopRecv ();
+      received++;
+    }
+  return received;
+}
+
+bool
+RadeepRawSocketImpl::PushRecv (const Data &data)
+{
+  NS_LOG_FUNCTION (this);
+  uint32_t size = data.packet->GetSize ();
+  if (m_recv.size () != m_rcvBufPackets && m_recvCount == 0)
+    {
+      // The ring is sized on first use, or resized when the attribute
+      // changed while the queue was empty
+      m_recv.assign (m_rcvBufPackets, Data ());
+      m_recvHead = 0;
+    }
+  if (m_recvCount == m_recv.size () || m_rxAvailable + size > m_rcvBufSize)
+    {
+      return false;
+    }
+  m_recv[(m_recvHead + m_recvCount) % m_recv.size ()] = data;
+  m_recvCount++;
+  m_rxAvailable += size;
+  return true;
+}
+
+void
+RadeepRawSocketImpl::PopRecv (void)
+{
+  NS_LOG_FUNCTION (this);
+  NS_ASSERT (m_recvCount > 0);
+  struct Data &data = m_recv[m_recvHead];
+  m_rxAvailable -= data.packet->GetSize ();
+  // Release the packet now rather than when the slot is reused
+  data.packet = 0;
+  m_recvHead = (m_recvHead + 1) % m_recv.size ();
+  m_recvCount--;
+}
+
+void
+RadeepRawSocketImpl::SetFilter (Ptr<RadeepRawSocketFilter> filter)
+{
+  NS_LOG_FUNCTION (this << filter);
+  m_filter = filter;
+}
+
+Ptr<RadeepRawSocketFilter>
+RadeepRawSocketImpl::GetFilter (void) const
+{
+  return m_filter;
+}
+
+uint32_t
+RadeepRawSocketImpl::GetRxDrops (void) const
+{
+  return m_rxDrops;
 }
 
 void 
 RadeepRawSocketImpl::SetProtocol (uint16_t protocol)
 {
   NS_LOG_FUNCTION (this << protocol);
+  uint16_t previous = m_protocol;
   m_protocol = protocol;
+  // The stack indexes its raw sockets by protocol
+  if (m_node != 0 && previous != protocol)
+    {
+      Ptr<RadeepL3Protocol> radeep = m_node->GetObject<RadeepL3Protocol> ();
+      if (radeep != 0)
+        {
+          radeep->UpdateRawSocketProtocol (this, previous);
+        }
+    }
+}
+
+uint16_t
+RadeepRawSocketImpl::GetProtocol (void) const
+{
+  return m_protocol;
 }
 
 bool 
@@ -434,6 +632,22 @@ RadeepRawSocketImpl::ForwardUp (Ptr<const Packet> p, RadeepHeader RadeepHeader,
       (m_dst == RadeepAddress::GetAny () || RadeepHeader.GetSource () == m_dst) &&
       RadeepHeader.GetProtocol () == m_protocol)
     {
+      if (m_protocol == 1 && m_icmpFilter != 0)
+        {
+          // The type is the first byte of the ICMP header, no need to
+          // deserialize the whole header
+          uint8_t type;
+          if (p->CopyData (&type, 1) == 1 && type < 32 &&
+              ((uint32_t(1) << type) & m_icmpFilter))
+            {
+              // filter out icmp packet.
+              return false;
+            }
+        }
+      if (m_filter != 0 && !m_filter->Match (p, RadeepHeader))
+        {
+          return false;
+        }
       Ptr<Packet> copy = p->Copy ();
       // Should check via getsockopt ()..
       if (IsRecvPktInfo ())
@@ -459,25 +673,23 @@ RadeepRawSocketImpl::ForwardUp (Ptr<const Packet> p, RadeepHeader RadeepHeader,
           copy->AddPacketTag (RadeepTtlTag);
         }
 
-     if (m_protocol == 1)
-        {
-          Icmpv4Header icmpHeader;
-          copy->PeekHeader (icmpHeader);
-          uint8_t type = icmpHeader.GetType ();
-          if (type < 32 &&
-              ((uint32_t(1) << type) & m_icmpFilter))
-            {
-              // filter out icmp packet.
-              return false;
-            }
-        }
       copy->AddHeader (RadeepHeader);
       struct Data data;
       data.packet = copy;
       data.fromRadeep = RadeepHeader.GetSource ();
       data.fromProtocol = RadeepHeader.GetProtocol ();
-      m_recv.push_back (data);
-      NotifyDataRecv ();
+      bool wasEmpty = (m_recvCount == 0);
+      if (!PushRecv (data))
+        {
+          NS_LOG_LOGIC ("No receive buffer space available. Drop.");
+          m_rxDrops++;
+          m_dropTrace (copy);
+          return false;
+        }
+      if (!m_recvNotifyBatch || wasEmpty)
+        {
+          NotifyDataRecv ();
+        }
       return true;
     }
   return false;
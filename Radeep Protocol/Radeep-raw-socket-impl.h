@@ -5,7 +5,9 @@
 #include "ns3/Radeep-header.h"
 #include "ns3/Radeep-route.h"
 #include "ns3/Radeep-interface.h"
-#include <list>
+#include "ns3/Radeep-raw-socket-filter.h"
+#include "ns3/traced-callback.h"
+#include <vector>
 
 namespace ns3 {
 
@@ -54,6 +56,37 @@ public:
   virtual Ptr<Packet> RecvFrom (uint32_t maxSize, uint32_t flags,
                                 Address &fromAddress);
 
+  /**
+   * \brief Send several packets to the same destination.
+   *
+   * The route to the destination is resolved once for the whole batch,
+   * and the send callbacks are notified once, after the last packet.
+   * Sockets including the Radeep header, bound to a device, or sending
+   * to a broadcast address send the packets one by one with SendTo.
+   *
+   * \param packets the packets to send
+   * \param flags socket control flags
+   * \param toAddress the destination of all the packets
+   * \return the number of packets sent, or -1 if none could be sent
+   */
+  int SendBatch (const std::vector<Ptr<Packet> > &packets, uint32_t flags,
+                 const Address &toAddress);
+
+  /**
+   * \brief Receive several packets at once.
+   *
+   * Whole packets are removed from the head of the receive queue and
+   * appended to the output vectors.
+   *
+   * \param packets the received packets
+   * \param fromAddresses the source address of each received packet
+   * \param maxPackets maximum number of packets to receive
+   * \return the number of packets received
+   */
+  uint32_t RecvBatch (std::vector<Ptr<Packet> > &packets,
+                      std::vector<Address> &fromAddresses,
+                      uint32_t maxPackets);
+
 
   /**
    * \brief Set protocol field.
@@ -61,6 +94,12 @@ public:
    */
   void SetProtocol (uint16_t protocol);
 
+  /**
+   * \brief Get protocol field.
+   * \return the protocol
+   */
+  uint16_t GetProtocol (void) const;
+
   /**
    * \brief Forward up to receive method.
    * \param p packet
@@ -72,6 +111,28 @@ public:
   virtual bool SetAllowBroadcast (bool allowBroadcast);
   virtual bool GetAllowBroadcast () const;
 
+  /**
+   * \brief Set the filter received packets must match.
+   *
+   * The filter runs after the address and protocol checks and before the
+   * packet is copied.  A filter can be shared by several sockets.
+   *
+   * \param filter the filter, or 0 to accept all the packets
+   */
+  void SetFilter (Ptr<RadeepRawSocketFilter> filter);
+
+  /**
+   * \return the filter received packets must match, or 0
+   */
+  Ptr<RadeepRawSocketFilter> GetFilter (void) const;
+
+  /**
+   * \brief Get the number of packets dropped because the receive queue
+   * was full.
+   * \return the number of dropped packets
+   */
+  uint32_t GetRxDrops (void) const;
+
 private:
   virtual void DoDispose (void);
 
@@ -85,15 +146,56 @@ private:
     uint16_t fromProtocol;   /**< Protocol used */
   };
 
+  /**
+   * \brief Add the tags requested by the socket options to a packet.
+   * \param p the packet to send
+   * \param dst the destination of the packet
+   * \param tos the type of service of the packet
+   */
+  void AddSendTags (Ptr<Packet> p, RadeepAddress dst, uint8_t tos);
+
+  /**
+   * \brief Find the route of an outgoing packet.
+   * \param radeep the Radeep stack of the node
+   * \param p the packet to send
+   * \param header the header of the packet
+   * \param src the source address of the packet
+   * \param errno_ the error number, if no route is found
+   * \return the route, or 0 if no route is found
+   */
+  Ptr<RadeepRoute> FindRoute (Ptr<Radeep> radeep, Ptr<Packet> p, const RadeepHeader &header,
+                              RadeepAddress src, Socket::SocketErrno &errno_);
+
+  /**
+   * \brief Store a received packet at the tail of the receive queue.
+   * \param data the packet and its origin
+   * \return false if the queue is full and the packet was not stored
+   */
+  bool PushRecv (const Data &data);
+
+  /**
+   * \brief Remove the packet at the head of the receive queue.
+   */
+  void PopRecv (void);
+
   mutable enum Socket::SocketErrno m_err; //!< Last error number.
   Ptr<Node> m_node;                 //!< Node
   RadeepAddress m_src;                //!< Source address.
   RadeepAddress m_dst;                //!< Destination address.
   uint16_t m_protocol;              //!< Protocol.
-  std::list<struct Data> m_recv;    //!< Packet waiting to be processed.
+  std::vector<struct Data> m_recv;  //!< Ring of packets waiting to be processed.
+  uint32_t m_recvHead;              //!< Index of the oldest packet in m_recv.
+  uint32_t m_recvCount;             //!< Number of packets in m_recv.
+  uint32_t m_rxAvailable;           //!< Number of bytes in m_recv.
+  uint32_t m_rcvBufSize;            //!< Receive buffer size, in bytes.
+  uint32_t m_rcvBufPackets;         //!< Receive buffer size, in packets.
+  uint32_t m_rxDrops;               //!< Packets dropped because the buffer was full.
+  bool m_recvNotifyBatch;           //!< Notify reception only when the queue stops being empty.
+  TracedCallback<Ptr<const Packet> > m_dropTrace; //!< Trace for dropped packets
   bool m_shutdownSend;              //!< Flag to shutdown send capability.
   bool m_shutdownRecv;              //!< Flag to shutdown receive capability.
   uint32_t m_icmpFilter;            //!< ICMPv4 filter specification
+  Ptr<RadeepRawSocketFilter> m_filter; //!< Filter of received packets
   bool m_radeephdrincl;                 //!< Include Radeep Header information (a.k.a setsockopt (RADEEP_HDRINCL))
 };
 
@@ -0,0 +1,148 @@
+#ifndef RADEEP_ROUTE_ARENA_H
+#define RADEEP_ROUTE_ARENA_H
+
+#include <vector>
+#include <stdint.h>
+#include "ns3/assert.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup RadeepRouting
+ *
+ * \brief Block allocator for routing table entries.
+ *
+ * Entries are stored in blocks of BLOCK_SIZE contiguous slots, so that a
+ * table of many routes is a few large allocations instead of one per
+ * route, and the entries of a table are close to each other in memory.
+ * The address of an entry never changes until it is released.
+ *
+ * Released slots are reset to a default value and reused by the next
+ * allocations.  Clear () releases all the entries by freeing the blocks.
+ */
+template <typename T>
+class RadeepRouteArena
+{
+public:
+  /// Number of entries in a block
+  static const uint32_t BLOCK_SIZE = 256;
+
+  RadeepRouteArena ();
+  ~RadeepRouteArena ();
+
+  /**
+   * \brief Store a copy of a value.
+   * \param value the value to copy
+   * \return the address of the copy, valid until it is released
+   */
+  T *Allocate (const T &value);
+
+  /**
+   * \brief Release a value previously allocated.
+   * \param value the value to release
+   */
+  void Release (T *value);
+
+  /**
+   * \brief Release all the values and free the blocks.
+   */
+  void Clear (void);
+
+  /**
+   * \return the number of values allocated and not released
+   */
+  uint32_t GetN (void) const;
+
+private:
+  /**
+   * \brief Copy constructor, disabled: values are referred to by address.
+   * \param o object to copy
+   */
+  RadeepRouteArena (const RadeepRouteArena &o);
+
+  /**
+   * \brief Assignment operator, disabled: values are referred to by address.
+   * \param o object to copy
+   * \return this object
+   */
+  RadeepRouteArena &operator= (const RadeepRouteArena &o);
+
+  std::vector<T *> m_blocks; //!< blocks of BLOCK_SIZE slots
+  std::vector<T *> m_free;   //!< released slots
+  uint32_t m_used;           //!< slots used in the last block
+  uint32_t m_n;              //!< number of values
+};
+
+template <typename T>
+RadeepRouteArena<T>::RadeepRouteArena ()
+  : m_used (BLOCK_SIZE),
+    m_n (0)
+{
+}
+
+template <typename T>
+RadeepRouteArena<T>::~RadeepRouteArena ()
+{
+  Clear ();
+}
+
+template <typename T>
+T *
+RadeepRouteArena<T>::Allocate (const T &value)
+{
+  T *slot;
+  if (!m_free.empty ())
+    {
+      slot = m_free.back ();
+      m_free.pop_back ();
+    }
+  else
+    {
+      if (m_used == BLOCK_SIZE)
+        {
+          m_blocks.push_back (new T[BLOCK_SIZE]);
+          m_used = 0;
+        }
+      slot = &m_blocks.back ()[m_used];
+      m_used++;
+    }
+  *slot = value;
+  m_n++;
+  return slot;
+}
+
+template <typename T>
+void
+RadeepRouteArena<T>::Release (T *value)
+{
+  NS_ASSERT (m_n > 0);
+  // Drop whatever the value holds now rather than when the slot is reused
+  *value = T ();
+  m_free.push_back (value);
+  m_n--;
+}
+
+template <typename T>
+void
+RadeepRouteArena<T>::Clear (void)
+{
+  for (typename std::vector<T *>::iterator i = m_blocks.begin (); i != m_blocks.end (); i++)
+    {
+      delete [] *i;
+    }
+  m_blocks.clear ();
+  m_free.clear ();
+  m_used = BLOCK_SIZE;
+  m_n = 0;
+}
+
+template <typename T>
+uint32_t
+RadeepRouteArena<T>::GetN (void) const
+{
+  return m_n;
+}
+
+} // namespace ns3
+
+#endif /* RADEEP_ROUTE_ARENA_H */
@@ -0,0 +1,278 @@
+#ifndef RADEEP_ROUTE_TRIE_H
+#define RADEEP_ROUTE_TRIE_H
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "ns3/assert.h"
+#include "ns3/Radeep-address.h"
+
+namespace ns3 {
+
+/**
+ * \ingroup RadeepRouting
+ *
+ * \brief Binary trie indexing routing table values by destination prefix.
+ *
+ * Each node of the trie stands for one prefix and holds the values
+ * installed for exactly that prefix, in insertion order.  A lookup walks
+ * at most 33 nodes along the bits of the destination address, so its
+ * cost depends on the address length and not on the number of routes.
+ *
+ * Only contiguous masks can be indexed; callers are expected to check
+ * IsContiguous () and to keep routes with other masks elsewhere.
+ *
+ * Nodes live in a single vector and refer to each other by index.  Nodes
+ * left without values and children by Remove () are recycled.
+ */
+template <typename T>
+class RadeepRouteTrie
+{
+public:
+  /// Values installed for one prefix, in insertion order
+  typedef std::vector<T> Bucket;
+
+  /// Maximum number of prefixes a destination can match (/0 to /32)
+  static const uint32_t MAX_MATCHES = 33;
+
+  RadeepRouteTrie ();
+
+  /**
+   * \param mask the mask to check
+   * \return true if the mask is made of leading ones only
+   */
+  static bool IsContiguous (RadeepMask mask);
+
+  /**
+   * \brief Add a value for a prefix.
+   * \param network the prefix address
+   * \param mask the prefix mask, which must be contiguous
+   * \param value the value to add
+   */
+  void Insert (RadeepAddress network, RadeepMask mask, const T &value);
+
+  /**
+   * \brief Remove a value previously added for a prefix.
+   * \param network the prefix address
+   * \param mask the prefix mask
+   * \param value the value to remove
+   * \return true if the value was found and removed
+   */
+  bool Remove (RadeepAddress network, RadeepMask mask, const T &value);
+
+  /**
+   * \brief Remove all the values.
+   */
+  void Clear (void);
+
+  /**
+   * \return the number of values stored in the trie
+   */
+  uint32_t GetN (void) const;
+
+  /**
+   * \brief Find the prefixes matching a destination.
+   *
+   * Buckets are returned by increasing prefix length, so the longest
+   * match is the last one.  Only non-empty buckets are returned.
+   *
+   * \param dest the destination address
+   * \param matches output array of matching buckets
+   * \param lengths output array with the prefix length of each bucket
+   * \return the number of buckets stored in matches
+   */
+  uint32_t Lookup (RadeepAddress dest,
+                   const Bucket *matches[MAX_MATCHES],
+                   uint8_t lengths[MAX_MATCHES]) const;
+
+private:
+  /// Marker for a missing child
+  static const uint32_t NONE = 0xffffffff;
+
+  /// A trie node
+  struct Node
+  {
+    uint32_t child[2]; //!< index of the children, NONE if absent
+    Bucket values;     //!< values installed for this prefix
+  };
+
+  /**
+   * \brief Get the bit of an address at a given depth.
+   * \param address host-order address
+   * \param depth depth in the trie, between 0 and 31
+   * \return the bit, 0 or 1
+   */
+  static uint32_t GetBit (uint32_t address, uint32_t depth);
+
+  /**
+   * \return the index of a fresh node
+   */
+  uint32_t AllocateNode (void);
+
+  std::vector<Node> m_nodes;     //!< nodes, the root is at index 0
+  std::vector<uint32_t> m_free;  //!< recycled node indexes
+  uint32_t m_n;                  //!< number of values
+};
+
+template <typename T>
+RadeepRouteTrie<T>::RadeepRouteTrie ()
+  : m_n (0)
+{
+  AllocateNode ();
+}
+
+template <typename T>
+bool
+RadeepRouteTrie<T>::IsContiguous (RadeepMask mask)
+{
+  uint32_t inverse = ~mask.Get ();
+  return (inverse & (inverse + 1)) == 0;
+}
+
+template <typename T>
+uint32_t
+RadeepRouteTrie<T>::GetBit (uint32_t address, uint32_t depth)
+{
+  return (address >> (31 - depth)) & 0x1;
+}
+
+template <typename T>
+uint32_t
+RadeepRouteTrie<T>::AllocateNode (void)
+{
+  uint32_t index;
+  if (!m_free.empty ())
+    {
+      index = m_free.back ();
+      m_free.pop_back ();
+    }
+  else
+    {
+      index = m_nodes.size ();
+      m_nodes.push_back (Node ());
+    }
+  m_nodes[index].child[0] = NONE;
+  m_nodes[index].child[1] = NONE;
+  m_nodes[index].values.clear ();
+  return index;
+}
+
+template <typename T>
+void
+RadeepRouteTrie<T>::Insert (RadeepAddress network, RadeepMask mask, const T &value)
+{
+  NS_ASSERT_MSG (IsContiguous (mask), "RadeepRouteTrie only supports contiguous masks");
+  uint32_t address = network.Get ();
+  uint32_t length = mask.GetPrefixLength ();
+  uint32_t node = 0;
+  for (uint32_t depth = 0; depth < length; depth++)
+    {
+      uint32_t bit = GetBit (address, depth);
+      if (m_nodes[node].child[bit] == NONE)
+        {
+          // AllocateNode may reallocate m_nodes, do not keep references
+          uint32_t child = AllocateNode ();
+          m_nodes[node].child[bit] = child;
+        }
+      node = m_nodes[node].child[bit];
+    }
+  m_nodes[node].values.push_back (value);
+  m_n++;
+}
+
+template <typename T>
+bool
+RadeepRouteTrie<T>::Remove (RadeepAddress network, RadeepMask mask, const T &value)
+{
+  if (!IsContiguous (mask))
+    {
+      return false;
+    }
+  uint32_t address = network.Get ();
+  uint32_t length = mask.GetPrefixLength ();
+  uint32_t path[MAX_MATCHES];
+  path[0] = 0;
+  for (uint32_t depth = 0; depth < length; depth++)
+    {
+      uint32_t child = m_nodes[path[depth]].child[GetBit (address, depth)];
+      if (child == NONE)
+        {
+          return false;
+        }
+      path[depth + 1] = child;
+    }
+
+  Bucket &values = m_nodes[path[length]].values;
+  typename Bucket::iterator it = std::find (values.begin (), values.end (), value);
+  if (it == values.end ())
+    {
+      return false;
+    }
+  values.erase (it);
+  m_n--;
+
+  // Unlink the nodes left without any purpose, bottom up.  The root stays.
+  for (uint32_t depth = length; depth > 0; depth--)
+    {
+      Node &node = m_nodes[path[depth]];
+      if (!node.values.empty () || node.child[0] != NONE || node.child[1] != NONE)
+        {
+          break;
+        }
+      m_nodes[path[depth - 1]].child[GetBit (address, depth - 1)] = NONE;
+      m_free.push_back (path[depth]);
+    }
+  return true;
+}
+
+template <typename T>
+void
+RadeepRouteTrie<T>::Clear (void)
+{
+  m_nodes.clear ();
+  m_free.clear ();
+  m_n = 0;
+  AllocateNode ();
+}
+
+template <typename T>
+uint32_t
+RadeepRouteTrie<T>::GetN (void) const
+{
+  return m_n;
+}
+
+template <typename T>
+uint32_t
+RadeepRouteTrie<T>::Lookup (RadeepAddress dest,
+                            const Bucket *matches[MAX_MATCHES],
+                            uint8_t lengths[MAX_MATCHES]) const
+{
+  uint32_t address = dest.Get ();
+  uint32_t nMatches = 0;
+  uint32_t node = 0;
+  for (uint32_t depth = 0; ; depth++)
+    {
+      const Node &current = m_nodes[node];
+      if (!current.values.empty ())
+        {
+          matches[nMatches] = &current.values;
+          lengths[nMatches] = depth;
+          nMatches++;
+        }
+      if (depth == 32)
+        {
+          break;
+        }
+      node = current.child[GetBit (address, depth)];
+      if (node == NONE)
+        {
+          break;
+        }
+    }
+  return nMatches;
+}
+
+} // namespace ns3
+
+#endif /* RADEEP_ROUTE_TRIE_H */
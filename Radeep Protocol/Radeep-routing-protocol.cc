@@ -2,6 +2,8 @@
 #include "Radeep-route.h"
 #include "Radeep-routing-protocol.h"
 #include "ns3/log.h"
+#include "ns3/net-device.h"
+#include "ns3/trace-source-accessor.h"
 
 namespace ns3 {
 
@@ -14,8 +16,68 @@ TypeId RadeepRoutingProtocol::GetTypeId (void)
   static TypeId tid = TypeId ("ns3::RadeepRoutingProtocol")
     .SetParent<Object> ()
     .SetGroupName ("Internet")
+    .AddTraceSource ("RoutesChanged",
+                     "The routing table changed, and routes obtained "
+                     "from it may no longer be valid",
+                     MakeTraceSourceAccessor (&RadeepRoutingProtocol::m_routesChangedTrace),
+                     "ns3::RadeepRoutingProtocol::RoutesChangedTracedCallback")
   ;
   return tid;
 }
 
+RadeepRoutingProtocol::RadeepRoutingProtocol ()
+  : m_generation (0)
+{
+  NS_LOG_FUNCTION (this);
+}
+
+RadeepRoutingProtocol::InputContext::InputContext (Ptr<const NetDevice> idev, uint32_t iif,
+                                                   bool isLocal, const RadeepHeader &header)
+  : idev (idev),
+    iif (iif),
+    isLocal (isLocal),
+    isMulticast (header.GetDestination ().IsMulticast ())
+{
+}
+
+RadeepRoutingProtocol::InputContext
+RadeepRoutingProtocol::CreateInputContext (Ptr<Radeep> radeep, const RadeepHeader &header, Ptr<const NetDevice> idev)
+{
+  NS_LOG_FUNCTION (radeep << header << idev);
+  NS_ASSERT (radeep != 0);
+  // Check if input device supports Radeep
+  NS_ASSERT (radeep->GetInterfaceForDevice (idev) >= 0);
+  uint32_t iif = radeep->GetInterfaceForDevice (idev);
+  return InputContext (idev, iif, radeep->IsDestinationAddress (header.GetDestination (), iif), header);
+}
+
+bool
+RadeepRoutingProtocol::RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                              const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                              const LocalDeliverCallback &lcb, const ErrorCallback &ecb)
+{
+  NS_LOG_FUNCTION (this << p << header << context.iif);
+  return RouteInput (p, header, context.idev, ucb, mcb, lcb, ecb);
+}
+
+uint32_t
+RadeepRoutingProtocol::GetGeneration (void) const
+{
+  return m_generation;
+}
+
+bool
+RadeepRoutingProtocol::IsRouteOutputCacheable (void) const
+{
+  return false;
+}
+
+void
+RadeepRoutingProtocol::NotifyRoutesChanged (void)
+{
+  NS_LOG_FUNCTION (this);
+  m_generation++;
+  m_routesChangedTrace (m_generation);
+}
+
 } // namespace ns3
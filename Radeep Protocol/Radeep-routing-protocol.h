@@ -13,6 +13,7 @@
 #include "Radeep.h"
 #include "ns3/output-stream-wrapper.h"
 #include "ns3/nstime.h"
+#include "ns3/traced-callback.h"
 
 namespace ns3 {
 
@@ -40,6 +41,45 @@ public:
 
   typedef Callback<void, Ptr<const Packet>, const RadeepHeader &, Socket::SocketErrno > ErrorCallback;
 
+  /**
+   * TracedCallback signature for routing table changes.
+   *
+   * \param [in] generation The new generation of the routing table.
+   */
+  typedef void (* RoutesChangedTracedCallback)(uint32_t generation);
+
+  /**
+   * \brief Information about a received packet, computed once by the Radeep
+   * layer and handed to every routing protocol asked to route the packet.
+   */
+  struct InputContext
+  {
+    /**
+     * \brief Constructor.
+     * \param idev the input device
+     * \param iif the input interface index
+     * \param isLocal true if the destination is an address of this node for iif
+     * \param header the Radeep header of the packet
+     */
+    InputContext (Ptr<const NetDevice> idev, uint32_t iif, bool isLocal, const RadeepHeader &header);
+
+    Ptr<const NetDevice> idev; //!< Input device
+    uint32_t iif;              //!< Input interface index
+    bool isLocal;              //!< True if the packet is for this node (Radeep::IsDestinationAddress)
+    bool isMulticast;          //!< True if the destination is a multicast address
+  };
+
+  /**
+   * \brief Build the input context of a packet.
+   * \param radeep the Radeep stack which received the packet
+   * \param header the Radeep header of the packet
+   * \param idev the input device
+   * \return the input context
+   */
+  static InputContext CreateInputContext (Ptr<Radeep> radeep, const RadeepHeader &header, Ptr<const NetDevice> idev);
+
+  RadeepRoutingProtocol ();
+
   virtual Ptr<RadeepRoute> RouteOutput (Ptr<Packet> p, const RadeepHeader &header, Ptr<NetDevice> oif, Socket::SocketErrno &sockerr) = 0;
 
   
@@ -47,6 +87,26 @@ public:
                             UnicastForwardCallback ucb, MulticastForwardCallback mcb,
                             LocalDeliverCallback lcb, ErrorCallback ecb) = 0;
 
+  /**
+   * \brief Route an input packet whose input context is already known.
+   *
+   * This is what the Radeep layer calls for every received packet.  The
+   * default implementation falls back to RouteInput (); protocols override
+   * it to reuse the context instead of recomputing it.
+   *
+   * \param p received packet
+   * \param header input parameter used to form a search key for a route
+   * \param context the input context of the packet
+   * \param ucb callback for unicast forwarding
+   * \param mcb callback for multicast forwarding
+   * \param lcb callback for local delivery
+   * \param ecb callback to call if there is an error in forwarding
+   * \return true if the packet was handled
+   */
+  virtual bool RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                      const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                      const LocalDeliverCallback &lcb, const ErrorCallback &ecb);
+
 
   virtual void NotifyInterfaceUp (uint32_t interface) = 0;
 
@@ -64,6 +124,46 @@ public:
 
   virtual void PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const = 0;
 
+  /**
+   * \brief Get the generation of the routing table.
+   *
+   * The generation changes whenever RouteOutput () may return a different
+   * route than before for the same arguments, so that a route cached with
+   * the generation is valid as long as the generation is unchanged.
+   * Caches that prefer to be told can connect to the RoutesChanged trace
+   * source instead of polling.
+   *
+   * \return the generation of the routing table
+   */
+  virtual uint32_t GetGeneration (void) const;
+
+  /**
+   * \brief Check if the routes returned by RouteOutput () can be cached.
+   *
+   * This is the case if RouteOutput () only depends on the destination of
+   * the header and the output device, and if GetGeneration () tracks every
+   * change of its result.  The default is false, which is
+   * always safe.
+   *
+   * \return true if RouteOutput () results can be cached
+   */
+  virtual bool IsRouteOutputCacheable (void) const;
+
+protected:
+  /**
+   * \brief Record that the routing table changed.
+   *
+   * Must be called by subclasses on every change that can affect
+   * RouteOutput (), including interface and address notifications.
+   * Increments the generation and fires the RoutesChanged trace source.
+   */
+  void NotifyRoutesChanged (void);
+
+private:
+  uint32_t m_generation; //!< Generation of the routing table
+
+  /// Trace of routing table changes, for caches to subscribe to
+  TracedCallback<uint32_t> m_routesChangedTrace;
 };
 
 } // namespace ns3
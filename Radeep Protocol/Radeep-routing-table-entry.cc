@@ -19,7 +19,8 @@ RadeepRoutingTableEntry::RadeepRoutingTableEntry (RadeepRoutingTableEntry const
   : m_dest (route.m_dest),
     m_destNetworkMask (route.m_destNetworkMask),
     m_gateway (route.m_gateway),
-    m_interface (route.m_interface)
+    m_interface (route.m_interface),
+    m_route (route.m_route)
 {
   NS_LOG_FUNCTION (this << route);
 }
@@ -28,7 +29,8 @@ RadeepRoutingTableEntry::RadeepRoutingTableEntry (RadeepRoutingTableEntry const
   : m_dest (route->m_dest),
     m_destNetworkMask (route->m_destNetworkMask),
     m_gateway (route->m_gateway),
-    m_interface (route->m_interface)
+    m_interface (route->m_interface),
+    m_route (route->m_route)
 {
   NS_LOG_FUNCTION (this << route);
 }
@@ -148,6 +150,19 @@ RadeepRoutingTableEntry::GetInterface (void) const
   return m_interface;
 }
 
+void
+RadeepRoutingTableEntry::SetRoute (Ptr<RadeepRoute> route)
+{
+  NS_LOG_FUNCTION (this << route);
+  m_route = route;
+}
+
+Ptr<RadeepRoute>
+RadeepRoutingTableEntry::GetRoute (void) const
+{
+  return m_route;
+}
+
 RadeepRoutingTableEntry 
 RadeepRoutingTableEntry::CreateHostRouteTo (RadeepAddress dest, 
                                           RadeepAddress nextHop,
@@ -6,6 +6,7 @@
 #include <ostream>
 
 #include "ns3/Radeep-address.h"
+#include "ns3/Radeep-route.h"
 
 namespace ns3 {
 
@@ -14,6 +15,11 @@ namespace ns3 {
  *
  * A record of an Radeep routing table entry for RadeepGlobalRouting and 
  * RadeepStaticRouting.  This is not a reference counted object.
+ *
+ * The routing protocol holding the entry can attach to it the RadeepRoute
+ * handed out by the lookups matching the entry, so that lookups do not
+ * build a new one every time.  That route is shared and must not be
+ * modified.
  */
 class RadeepRoutingTableEntry {
 public:
@@ -69,6 +75,16 @@ public:
    * \return The Radeep interface number used for sending outgoing packets
    */
   uint32_t GetInterface (void) const;
+  /**
+   * \brief Attach the route returned by the lookups matching this entry.
+   * \param route the route, or 0 to have it built again
+   */
+  void SetRoute (Ptr<RadeepRoute> route);
+  /**
+   * \return the route returned by the lookups matching this entry, or 0
+   * if it is not built yet
+   */
+  Ptr<RadeepRoute> GetRoute (void) const;
   /**
    * \return An RadeepRoutingTableEntry object corresponding to the input parameters.
    * \param dest RadeepAddress of the destination
@@ -157,6 +173,7 @@ private:
   RadeepMask m_destNetworkMask; //!< destination network mask
   RadeepAddress m_gateway;      //!< gateway
   uint32_t m_interface;       //!< output interface
+  Ptr<RadeepRoute> m_route;   //!< route returned by lookups, shared
 };
 
 /**
@@ -47,12 +47,11 @@ RadeepStaticRouting::AddNetworkRouteTo (RadeepAddress network,
                                       uint32_t metric)
 {
   NS_LOG_FUNCTION (this << network << " " << networkMask << " " << nextHop << " " << interface << " " << metric);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
-                                                        networkMask,
-                                                        nextHop,
-                                                        interface);
-  m_networkRoutes.push_back (make_pair (route,metric));
+  InsertNetworkRoute (RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
+                                                                    networkMask,
+                                                                    nextHop,
+                                                                    interface),
+                      metric);
 }
 
 void 
@@ -62,11 +61,10 @@ RadeepStaticRouting::AddNetworkRouteTo (RadeepAddress network,
                                       uint32_t metric)
 {
   NS_LOG_FUNCTION (this << network << " " << networkMask << " " << interface << " " << metric);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
-  *route = RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
-                                                        networkMask,
-                                                        interface);
-  m_networkRoutes.push_back (make_pair (route,metric));
+  InsertNetworkRoute (RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
+                                                                    networkMask,
+                                                                    interface),
+                      metric);
 }
 
 void 
@@ -108,6 +106,7 @@ RadeepStaticRouting::AddMulticastRoute (RadeepAddress origin,
   *route = RadeepMulticastRoutingTableEntry::CreateMulticastRoute (origin, group, 
                                                                  inputInterface, outputInterfaces);
   m_multicastRoutes.push_back (route);
+  NotifyRoutesChanged ();
 }
 
 // default multicast routes are stored as a network route
@@ -117,13 +116,12 @@ void
 RadeepStaticRouting::SetDefaultMulticastRoute (uint32_t outputInterface)
 {
   NS_LOG_FUNCTION (this << outputInterface);
-  RadeepRoutingTableEntry *route = new RadeepRoutingTableEntry ();
   RadeepAddress network = RadeepAddress ("224.0.0.0");
   RadeepMask networkMask = RadeepMask ("240.0.0.0");
-  *route = RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
-                                                        networkMask,
-                                                        outputInterface);
-  m_networkRoutes.push_back (make_pair (route,0));
+  InsertNetworkRoute (RadeepRoutingTableEntry::CreateNetworkRouteTo (network,
+                                                                    networkMask,
+                                                                    outputInterface),
+                      0);
 }
 
 uint32_t 
@@ -174,6 +172,7 @@ RadeepStaticRouting::RemoveMulticastRoute (RadeepAddress origin,
         {
           delete *i;
           m_multicastRoutes.erase (i);
+          NotifyRoutesChanged ();
           return true;
         }
     }
@@ -193,6 +192,7 @@ RadeepStaticRouting::RemoveMulticastRoute (uint32_t index)
         {
           delete *i;
           m_multicastRoutes.erase (i);
+          NotifyRoutesChanged ();
           return;
         }
       tmp++;
@@ -219,19 +219,23 @@ RadeepStaticRouting::LookupStatic (RadeepAddress dest, Ptr<NetDevice> oif)
       return rtentry;
     }
 
-
-  for (NetworkRoutesI i = m_networkRoutes.begin (); 
-       i != m_networkRoutes.end (); 
-       i++) 
+  // Walk the matching prefixes from the longest one; the first prefix
+  // holding a route usable on oif wins, and within a prefix the route
+  // with the lowest metric wins (the last one added on equal metrics).
+  // Host routes keep the first usable route, as a linear scan would.
+  RadeepRoutingTableEntry *route = 0;
+  const NetworkRoutesTrie::Bucket *matches[NetworkRoutesTrie::MAX_MATCHES];
+  uint8_t lengths[NetworkRoutesTrie::MAX_MATCHES];
+  uint32_t nMatches = m_networkRoutesTrie.Lookup (dest, matches, lengths);
+  for (uint32_t k = nMatches; k > 0 && route == 0; k--)
     {
-      RadeepRoutingTableEntry *j=i->first;
-      uint32_t metric =i->second;
-      RadeepMask mask = (j)->GetDestNetworkMask ();
-      uint16_t masklen = mask.GetPrefixLength ();
-      RadeepAddress entry = (j)->GetDestNetwork ();
-      NS_LOG_LOGIC ("Searching for route to " << dest << ", checking against route to " << entry << "/" << masklen);
-      if (mask.IsMatch (dest, entry)) 
+      uint16_t masklen = lengths[k - 1];
+      for (NetworkRoutesTrie::Bucket::const_iterator i = matches[k - 1]->begin ();
+           i != matches[k - 1]->end ();
+           i++)
         {
+          RadeepRoutingTableEntry *j = i->first;
+          uint32_t metric = i->second;
           NS_LOG_LOGIC ("Found global network route " << j << ", mask length " << masklen << ", metric " << metric);
           if (oif != 0)
             {
@@ -241,35 +245,54 @@ RadeepStaticRouting::LookupStatic (RadeepAddress dest, Ptr<NetDevice> oif)
                   continue;
                 }
             }
-          if (masklen < longest_mask) // Not interested if got shorter mask
-            {
-              NS_LOG_LOGIC ("Previous match longer, skipping");
-              continue;
-            }
-          if (masklen > longest_mask) // Reset metric if longer masklen
-            {
-              shortest_metric = 0xffffffff;
-            }
-          longest_mask = masklen;
           if (metric > shortest_metric)
             {
               NS_LOG_LOGIC ("Equal mask length, but previous metric shorter, skipping");
               continue;
             }
           shortest_metric = metric;
-          RadeepRoutingTableEntry* route = (j);
-          uint32_t interfaceIdx = route->GetInterface ();
-          rtentry = Create<RadeepRoute> ();
-          rtentry->SetDestination (route->GetDest ());
-          rtentry->SetSource (m_radeep->SourceAddressSelection (interfaceIdx, route->GetDest ()));
-          rtentry->SetGateway (route->GetGateway ());
-          rtentry->SetOutputDevice (m_radeep->GetNetDevice (interfaceIdx));
+          longest_mask = masklen;
+          route = j;
           if (masklen == 32)
             {
               break;
             }
         }
     }
+
+  // Routes with non-contiguous masks are compared with the best match
+  // found so far; on a tie the indexed route is kept.
+  for (NetworkRoutesI i = m_nonContiguousRoutes.begin ();
+       i != m_nonContiguousRoutes.end ();
+       i++)
+    {
+      RadeepRoutingTableEntry *j = i->first;
+      uint32_t metric = i->second;
+      RadeepMask mask = j->GetDestNetworkMask ();
+      uint16_t masklen = mask.GetPrefixLength ();
+      NS_LOG_LOGIC ("Searching for route to " << dest << ", checking against route to " << j->GetDestNetwork () << "/" << mask);
+      if (!mask.IsMatch (dest, j->GetDestNetwork ()))
+        {
+          continue;
+        }
+      if (oif != 0 && oif != m_radeep->GetNetDevice (j->GetInterface ()))
+        {
+          NS_LOG_LOGIC ("Not on requested interface, skipping");
+          continue;
+        }
+      if (route != 0 && (masklen < longest_mask || (masklen == longest_mask && metric >= shortest_metric)))
+        {
+          continue;
+        }
+      longest_mask = masklen;
+      shortest_metric = metric;
+      route = j;
+    }
+
+  if (route != 0)
+    {
+      rtentry = GetEntryRoute (route);
+    }
   if (rtentry != 0)
     {
       NS_LOG_LOGIC ("Matching route via " << rtentry->GetGateway () << " at the end");
@@ -427,8 +450,7 @@ RadeepStaticRouting::RemoveRoute (uint32_t index)
     {
       if (tmp == index)
         {
-          delete j->first;
-          m_networkRoutes.erase (j);
+          EraseNetworkRoute (j);
           return;
         }
       tmp++;
@@ -436,6 +458,107 @@ RadeepStaticRouting::RemoveRoute (uint32_t index)
   NS_ASSERT (false);
 }
 
+void
+RadeepStaticRouting::InsertNetworkRoute (const RadeepRoutingTableEntry &entry, uint32_t metric)
+{
+  NS_LOG_FUNCTION (this << entry << metric);
+  RadeepRoutingTableEntry *route = m_networkRoutesArena.Allocate (entry);
+  m_networkRoutes.push_back (make_pair (route, metric));
+  NetworkRoutesI it = m_networkRoutes.end ();
+  m_interfaceRoutes[route->GetInterface ()][route] = --it;
+  IndexNetworkRoute (*it);
+}
+
+RadeepStaticRouting::NetworkRoutesI
+RadeepStaticRouting::EraseNetworkRoute (NetworkRoutesI route)
+{
+  NS_LOG_FUNCTION (this << route->first);
+  UnindexNetworkRoute (*route);
+  InterfaceRoutesIndex::iterator routes = m_interfaceRoutes.find (route->first->GetInterface ());
+  if (routes != m_interfaceRoutes.end ())
+    {
+      routes->second.erase (route->first);
+      if (routes->second.empty ())
+        {
+          m_interfaceRoutes.erase (routes);
+        }
+    }
+  m_networkRoutesArena.Release (route->first);
+  return m_networkRoutes.erase (route);
+}
+
+void
+RadeepStaticRouting::IndexNetworkRoute (const std::pair <RadeepRoutingTableEntry *, uint32_t> &route)
+{
+  NS_LOG_FUNCTION (this << route.first << route.second);
+  RadeepMask mask = route.first->GetDestNetworkMask ();
+  if (NetworkRoutesTrie::IsContiguous (mask))
+    {
+      m_networkRoutesTrie.Insert (route.first->GetDestNetwork (), mask, route);
+    }
+  else
+    {
+      m_nonContiguousRoutes.push_back (route);
+    }
+  uint32_t interface = route.first->GetInterface ();
+  if (m_radeep != 0 && interface < m_radeep->GetNInterfaces () && m_radeep->GetNAddresses (interface) > 0)
+    {
+      GetEntryRoute (route.first);
+    }
+  NotifyRoutesChanged ();
+}
+
+void
+RadeepStaticRouting::UnindexNetworkRoute (const std::pair <RadeepRoutingTableEntry *, uint32_t> &route)
+{
+  NS_LOG_FUNCTION (this << route.first << route.second);
+  RadeepMask mask = route.first->GetDestNetworkMask ();
+  if (NetworkRoutesTrie::IsContiguous (mask))
+    {
+      m_networkRoutesTrie.Remove (route.first->GetDestNetwork (), mask, route);
+    }
+  else
+    {
+      m_nonContiguousRoutes.remove (route);
+    }
+  NotifyRoutesChanged ();
+}
+
+Ptr<RadeepRoute>
+RadeepStaticRouting::GetEntryRoute (RadeepRoutingTableEntry *entry)
+{
+  NS_LOG_FUNCTION (this << entry);
+  Ptr<RadeepRoute> rtentry = entry->GetRoute ();
+  if (rtentry == 0)
+    {
+      uint32_t interfaceIdx = entry->GetInterface ();
+      rtentry = Create<RadeepRoute> ();
+      rtentry->SetDestination (entry->GetDest ());
+      rtentry->SetSource (m_radeep->SourceAddressSelection (interfaceIdx, entry->GetDest ()));
+      rtentry->SetGateway (entry->GetGateway ());
+      rtentry->SetOutputDevice (m_radeep->GetNetDevice (interfaceIdx));
+      entry->SetRoute (rtentry);
+    }
+  return rtentry;
+}
+
+void
+RadeepStaticRouting::ResetEntryRoutes (uint32_t interface)
+{
+  NS_LOG_FUNCTION (this << interface);
+  InterfaceRoutesIndex::iterator routes = m_interfaceRoutes.find (interface);
+  if (routes == m_interfaceRoutes.end ())
+    {
+      return;
+    }
+  for (InterfaceRoutes::iterator it = routes->second.begin (); it != routes->second.end (); it++)
+    {
+      it->first->SetRoute (0);
+    }
+  // The routes already handed out may carry a source address gone stale
+  NotifyRoutesChanged ();
+}
+
 Ptr<RadeepRoute> 
 RadeepStaticRouting::RouteOutput (Ptr<Packet> p, const RadeepHeader &header, Ptr<NetDevice> oif, Socket::SocketErrno &sockerr)
 {
@@ -472,19 +595,26 @@ RadeepStaticRouting::RouteInput  (Ptr<const Packet> p, const RadeepHeader &ipHea
                                 LocalDeliverCallback lcb, ErrorCallback ecb)
 {
   NS_LOG_FUNCTION (this << p << ipHeader << ipHeader.GetSource () << ipHeader.GetDestination () << idev << &ucb << &mcb << &lcb << &ecb);
+  return RouteInputWithContext (p, ipHeader, CreateInputContext (m_radeep, ipHeader, idev), ucb, mcb, lcb, ecb);
+}
+
+bool
+RadeepStaticRouting::RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &ipHeader, const InputContext &context,
+                                            const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                            const LocalDeliverCallback &lcb, const ErrorCallback &ecb)
+{
+  NS_LOG_FUNCTION (this << p << ipHeader << ipHeader.GetSource () << ipHeader.GetDestination () << context.iif << &ucb << &mcb << &lcb << &ecb);
 
   NS_ASSERT (m_radeep != 0);
-  // Check if input device supports IP 
-  NS_ASSERT (m_radeep->GetInterfaceForDevice (idev) >= 0);
-  uint32_t iif = m_radeep->GetInterfaceForDevice (idev); 
+  uint32_t iif = context.iif;
 
   // Multicast recognition; handle local delivery here
 
-  if (ipHeader.GetDestination ().IsMulticast ())
+  if (context.isMulticast)
     {
       NS_LOG_LOGIC ("Multicast destination");
       Ptr<RadeepMulticastRoute> mrtentry =  LookupStatic (ipHeader.GetSource (),
-                                                        ipHeader.GetDestination (), m_radeep->GetInterfaceForDevice (idev));
+                                                        ipHeader.GetDestination (), iif);
 
       if (mrtentry)
         {
@@ -499,7 +629,7 @@ RadeepStaticRouting::RouteInput  (Ptr<const Packet> p, const RadeepHeader &ipHea
         }
     }
 
-  if (m_radeep->IsDestinationAddress (ipHeader.GetDestination (), iif))
+  if (context.isLocal)
     {
       if (!lcb.IsNull ())
         {
@@ -549,12 +679,12 @@ void
 RadeepStaticRouting::DoDispose (void)
 {
   NS_LOG_FUNCTION (this);
-  for (NetworkRoutesI j = m_networkRoutes.begin (); 
-       j != m_networkRoutes.end (); 
-       j = m_networkRoutes.erase (j)) 
-    {
-      delete (j->first);
-    }
+  // The entries are freed block by block
+  m_networkRoutes.clear ();
+  m_interfaceRoutes.clear ();
+  m_networkRoutesArena.Clear ();
+  m_networkRoutesTrie.Clear ();
+  m_nonContiguousRoutes.clear ();
   for (MulticastRoutesI i = m_multicastRoutes.begin (); 
        i != m_multicastRoutes.end (); 
        i = m_multicastRoutes.erase (i)) 
@@ -589,17 +719,17 @@ RadeepStaticRouting::NotifyInterfaceDown (uint32_t i)
 {
   NS_LOG_FUNCTION (this << i);
   // Remove all static routes that are going through this interface
-  for (NetworkRoutesI it = m_networkRoutes.begin (); it != m_networkRoutes.end (); )
+  InterfaceRoutesIndex::iterator routes = m_interfaceRoutes.find (i);
+  if (routes == m_interfaceRoutes.end ())
     {
-      if (it->first->GetInterface () == i)
-        {
-          delete it->first;
-          it = m_networkRoutes.erase (it);
-        }
-      else
-        {
-          it++;
-        }
+      return;
+    }
+  // Walk a copy, EraseNetworkRoute updates the index
+  InterfaceRoutes interfaceRoutes;
+  interfaceRoutes.swap (routes->second);
+  for (InterfaceRoutes::iterator it = interfaceRoutes.begin (); it != interfaceRoutes.end (); it++)
+    {
+      EraseNetworkRoute (it->second);
     }
 }
 
@@ -607,6 +737,7 @@ void
 RadeepStaticRouting::NotifyAddAddress (uint32_t interface, RadeepInterfaceAddress address)
 {
   NS_LOG_FUNCTION (this << interface << " " << address.GetLocal ());
+  ResetEntryRoutes (interface);
   if (!m_radeep->IsUp (interface))
     {
       return;
@@ -625,6 +756,7 @@ void
 RadeepStaticRouting::NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAddress address)
 {
   NS_LOG_FUNCTION (this << interface << " " << address.GetLocal ());
+  ResetEntryRoutes (interface);
   if (!m_radeep->IsUp (interface))
     {
       return;
@@ -633,21 +765,25 @@ RadeepStaticRouting::NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAdd
   RadeepMask networkMask = address.GetMask ();
   // Remove all static routes that are going through this interface
   // which reference this network
-  for (NetworkRoutesI it = m_networkRoutes.begin (); it != m_networkRoutes.end (); )
+  InterfaceRoutesIndex::iterator routes = m_interfaceRoutes.find (interface);
+  if (routes == m_interfaceRoutes.end ())
+    {
+      return;
+    }
+  std::vector<NetworkRoutesI> removed;
+  for (InterfaceRoutes::iterator it = routes->second.begin (); it != routes->second.end (); it++)
     {
-      if (it->first->GetInterface () == interface
-          && it->first->IsNetwork ()
+      if (it->first->IsNetwork ()
           && it->first->GetDestNetwork () == networkAddress
           && it->first->GetDestNetworkMask () == networkMask)
         {
-          delete it->first;
-          it = m_networkRoutes.erase (it);
-        }
-      else
-        {
-          it++;
+          removed.push_back (it->second);
         }
     }
+  for (std::vector<NetworkRoutesI>::iterator it = removed.begin (); it != removed.end (); it++)
+    {
+      EraseNetworkRoute (*it);
+    }
 }
 
 void 
@@ -668,6 +804,12 @@ RadeepStaticRouting::SetRadeep (Ptr<Radeep> radeep)
         }
     }
 }
+bool
+RadeepStaticRouting::IsRouteOutputCacheable (void) const
+{
+  return true;
+}
+
 // Formatted like output of "route -n" command
 void
 RadeepStaticRouting::PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit) const
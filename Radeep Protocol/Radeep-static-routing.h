@@ -3,6 +3,8 @@
 
 #include <list>
 #include <utility>
+#include <vector>
+#include <unordered_map>
 #include <stdint.h>
 #include "ns3/Radeep-address.h"
 #include "ns3/Radeep-header.h"
@@ -10,6 +12,8 @@
 #include "ns3/ptr.h"
 #include "ns3/Radeep.h"
 #include "ns3/Radeep-routing-protocol.h"
+#include "ns3/Radeep-route-trie.h"
+#include "ns3/Radeep-route-arena.h"
 
 namespace ns3 {
 
@@ -58,6 +62,9 @@ public:
   virtual bool RouteInput  (Ptr<const Packet> p, const RadeepHeader &header, Ptr<const NetDevice> idev,
                             UnicastForwardCallback ucb, MulticastForwardCallback mcb,
                             LocalDeliverCallback lcb, ErrorCallback ecb);
+  virtual bool RouteInputWithContext (Ptr<const Packet> p, const RadeepHeader &header, const InputContext &context,
+                                      const UnicastForwardCallback &ucb, const MulticastForwardCallback &mcb,
+                                      const LocalDeliverCallback &lcb, const ErrorCallback &ecb);
 
   virtual void NotifyInterfaceUp (uint32_t interface);
   virtual void NotifyInterfaceDown (uint32_t interface);
@@ -65,6 +72,7 @@ public:
   virtual void NotifyRemoveAddress (uint32_t interface, RadeepInterfaceAddress address);
   virtual void SetRadeep (Ptr<Radeep> radeep);
   virtual void PrintRoutingTable (Ptr<OutputStreamWrapper> stream, Time::Unit unit = Time::S) const;
+  virtual bool IsRouteOutputCacheable (void) const;
 
 /**
  * \brief Add a network route to the static routing table.
@@ -365,6 +373,15 @@ private:
   /// Iterator for container for the network routes
   typedef std::list<std::pair <RadeepRoutingTableEntry *, uint32_t> >::iterator NetworkRoutesI;
 
+  /// Network routes of one interface, with their position in the container
+  typedef std::unordered_map<RadeepRoutingTableEntry *, NetworkRoutesI> InterfaceRoutes;
+
+  /// Network routes by interface index
+  typedef std::unordered_map<uint32_t, InterfaceRoutes> InterfaceRoutesIndex;
+
+  /// Prefix index of the network routes
+  typedef RadeepRouteTrie<std::pair <RadeepRoutingTableEntry *, uint32_t> > NetworkRoutesTrie;
+
   /// Container for the multicast routes
   typedef std::list<RadeepMulticastRoutingTableEntry *> MulticastRoutes;
 
@@ -392,11 +409,77 @@ private:
   Ptr<RadeepMulticastRoute> LookupStatic (RadeepAddress origin, RadeepAddress group,
                                         uint32_t interface);
 
+  /**
+   * \brief Install a network route.
+   * \param entry the route
+   * \param metric the metric of the route
+   */
+  void InsertNetworkRoute (const RadeepRoutingTableEntry &entry, uint32_t metric);
+
+  /**
+   * \brief Remove an installed network route.
+   * \param route the route
+   * \return the route following the removed one in m_networkRoutes
+   */
+  NetworkRoutesI EraseNetworkRoute (NetworkRoutesI route);
+
+  /**
+   * \brief Add a network route to the lookup structures.
+   * \param route the route and its metric, as stored in m_networkRoutes
+   */
+  void IndexNetworkRoute (const std::pair <RadeepRoutingTableEntry *, uint32_t> &route);
+
+  /**
+   * \brief Remove a network route from the lookup structures.
+   * \param route the route and its metric, as stored in m_networkRoutes
+   */
+  void UnindexNetworkRoute (const std::pair <RadeepRoutingTableEntry *, uint32_t> &route);
+
+  /**
+   * \brief Get the route returned by the lookups matching an entry.
+   *
+   * The route is built once, when the entry is installed or on first use,
+   * and kept in the entry until the addresses of its interface change.
+   *
+   * \param entry the routing table entry
+   * \return the route
+   */
+  Ptr<RadeepRoute> GetEntryRoute (RadeepRoutingTableEntry *entry);
+
+  /**
+   * \brief Drop the routes built for the entries of an interface, and
+   * report a routing change if there were any.
+   * \param interface the interface index
+   */
+  void ResetEntryRoutes (uint32_t interface);
+
   /**
    * \brief the forwarding table for network.
    */
   NetworkRoutes m_networkRoutes;
 
+  /**
+   * \brief the network routes indexed by prefix, used by LookupStatic.
+   */
+  NetworkRoutesTrie m_networkRoutesTrie;
+
+  /**
+   * \brief the network routes whose mask is not contiguous.
+   *
+   * They cannot be stored in m_networkRoutesTrie and are scanned linearly.
+   */
+  NetworkRoutes m_nonContiguousRoutes;
+
+  /**
+   * \brief the network routes by interface, used by the interface notifications.
+   */
+  InterfaceRoutesIndex m_interfaceRoutes;
+
+  /**
+   * \brief the storage of the network route entries.
+   */
+  RadeepRouteArena<RadeepRoutingTableEntry> m_networkRoutesArena;
+
   /**
    * \brief the forwarding table for multicast.
    */
@@ -14,6 +14,9 @@
 #include "ns3/Radeep-routing-table-entry.h"
 #include "ns3/traffic-control-layer.h"
 
+#include <algorithm>
+#include <limits>
+
 #include "loopback-net-device.h"
 #include "arp-l3-protocol.h"
 #include "arp-cache.h"
@@ -49,6 +52,27 @@ RadeepL3Protocol::GetTypeId (void)
                    TimeValue (Seconds (30)),
                    MakeTimeAccessor (&RadeepL3Protocol::m_fragmentExpirationTimeout),
                    MakeTimeChecker ())
+    .AddAttribute ("FragmentMemoryLimit",
+                   "Maximum number of bytes held in the reassembly buffers. "
+                   "When exceeded, the oldest incomplete packets are evicted. "
+                   "Zero means no limit.",
+                   UintegerValue (4 * 1024 * 1024),
+                   MakeUintegerAccessor (&RadeepL3Protocol::m_fragmentMemoryLimit),
+                   MakeUintegerChecker<uint64_t> ())
+    .AddAttribute ("IdentificationBuckets",
+                   "Number of identification counters.  Outgoing packets "
+                   "draw their identification from the counter their "
+                   "{source, destination, protocol} tuple hashes to "
+                   "(RFC 6864, Section 5.1).",
+                   UintegerValue (4096),
+                   MakeUintegerAccessor (&RadeepL3Protocol::m_identificationBuckets),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("RouteCacheSize",
+                   "Maximum number of routes of locally originated packets "
+                   "kept in the destination cache. Zero disables the cache.",
+                   UintegerValue (256),
+                   MakeUintegerAccessor (&RadeepL3Protocol::m_routeCacheSize),
+                   MakeUintegerChecker<uint32_t> ())
     .AddTraceSource ("Tx",
                      "Send radeep packet to outgoing interface.",
                      MakeTraceSourceAccessor (&RadeepL3Protocol::m_txTrace),
@@ -88,8 +112,18 @@ RadeepL3Protocol::GetTypeId (void)
 }
 
 RadeepL3Protocol::RadeepL3Protocol()
+  : m_l4Demux (L4_DEMUX_SIZE),
+    m_socketsByProtocol (L4_DEMUX_SIZE),
+    m_routeCacheGeneration (0),
+    m_fragmentBytes (0),
+    m_fragmentEvictions (0),
+    m_fragmentTimeouts (0)
 {
   NS_LOG_FUNCTION (this);
+  m_unicastForwardCallback = MakeCallback (&RadeepL3Protocol::RadeepForward, this);
+  m_multicastForwardCallback = MakeCallback (&RadeepL3Protocol::RadeepMulticastForward, this);
+  m_localDeliverCallback = MakeCallback (&RadeepL3Protocol::LocalDeliver, this);
+  m_routeInputErrorCallback = MakeCallback (&RadeepL3Protocol::RouteInputError, this);
 }
 
 RadeepL3Protocol::~RadeepL3Protocol ()
@@ -107,6 +141,7 @@ RadeepL3Protocol::Insert (Ptr<RadeepL4Protocol> protocol)
       NS_LOG_WARN ("Overwriting default protocol " << int(protocol->GetProtocolNumber ()));
     }
   m_protocols[key] = protocol;
+  RebuildL4Demux ();
 }
 
 void
@@ -120,6 +155,7 @@ RadeepL3Protocol::Insert (Ptr<RadeepL4Protocol> protocol, uint32_t interfaceInde
       NS_LOG_WARN ("Overwriting protocol " << int(protocol->GetProtocolNumber ()) << " on interface " << int(interfaceIndex));
     }
   m_protocols[key] = protocol;
+  RebuildL4Demux ();
 }
 
 void
@@ -136,6 +172,7 @@ RadeepL3Protocol::Remove (Ptr<RadeepL4Protocol> protocol)
   else
     {
       m_protocols.erase (key);
+      RebuildL4Demux ();
     }
 }
 
@@ -153,6 +190,7 @@ RadeepL3Protocol::Remove (Ptr<RadeepL4Protocol> protocol, uint32_t interfaceInde
   else
     {
       m_protocols.erase (key);
+      RebuildL4Demux ();
     }
 }
 
@@ -169,27 +207,50 @@ RadeepL3Protocol::GetProtocol (int protocolNumber, int32_t interfaceIndex) const
 {
   NS_LOG_FUNCTION (this << protocolNumber << interfaceIndex);
 
-  L4ListKey_t key;
-  L4List_t::const_iterator i;
-  if (interfaceIndex >= 0)
+  if (protocolNumber < 0 || protocolNumber >= L4_DEMUX_SIZE)
     {
-      // try the interface-specific protocol.
-      key = std::make_pair (protocolNumber, interfaceIndex);
-      i = m_protocols.find (key);
-      if (i != m_protocols.end ())
+      return 0;
+    }
+  // try the interface-specific table, which falls back to the generic
+  // protocols by construction.
+  if (interfaceIndex >= 0 && uint32_t (interfaceIndex) < m_interfaceL4Demux.size ()
+      && !m_interfaceL4Demux[interfaceIndex].empty ())
+    {
+      return m_interfaceL4Demux[interfaceIndex][protocolNumber];
+    }
+  return m_l4Demux[protocolNumber];
+}
+
+void
+RadeepL3Protocol::RebuildL4Demux (void)
+{
+  NS_LOG_FUNCTION (this);
+  m_l4Demux.assign (L4_DEMUX_SIZE, Ptr<RadeepL4Protocol> ());
+  m_interfaceL4Demux.clear ();
+  for (L4List_t::const_iterator i = m_protocols.begin (); i != m_protocols.end (); ++i)
+    {
+      if (i->first.second < 0 && i->first.first >= 0 && i->first.first < L4_DEMUX_SIZE)
         {
-          return i->second;
+          m_l4Demux[i->first.first] = i->second;
         }
     }
-  // try the generic protocol.
-  key = std::make_pair (protocolNumber, -1);
-  i = m_protocols.find (key);
-  if (i != m_protocols.end ())
+  for (L4List_t::const_iterator i = m_protocols.begin (); i != m_protocols.end (); ++i)
     {
-      return i->second;
+      if (i->first.second < 0 || i->first.first < 0 || i->first.first >= L4_DEMUX_SIZE)
+        {
+          continue;
+        }
+      uint32_t interface = i->first.second;
+      if (interface >= m_interfaceL4Demux.size ())
+        {
+          m_interfaceL4Demux.resize (interface + 1);
+        }
+      if (m_interfaceL4Demux[interface].empty ())
+        {
+          m_interfaceL4Demux[interface] = m_l4Demux;
+        }
+      m_interfaceL4Demux[interface][i->first.first] = i->second;
     }
-
-  return 0;
 }
 
 void
@@ -208,6 +269,10 @@ RadeepL3Protocol::CreateRawSocket (void)
   Ptr<RadeepRawSocketImpl> socket = CreateObject<RadeepRawSocketImpl> ();
   socket->SetNode (m_node);
   m_sockets.push_back (socket);
+  if (socket->GetProtocol () < L4_DEMUX_SIZE)
+    {
+      m_socketsByProtocol[socket->GetProtocol ()].push_back (socket);
+    }
   return socket;
 }
 void 
@@ -218,12 +283,36 @@ RadeepL3Protocol::DeleteRawSocket (Ptr<Socket> socket)
     {
       if ((*i) == socket)
         {
+          uint16_t protocol = (*i)->GetProtocol ();
+          if (protocol < L4_DEMUX_SIZE)
+            {
+              m_socketsByProtocol[protocol].remove (*i);
+            }
           m_sockets.erase (i);
           return;
         }
     }
   return;
 }
+
+void
+RadeepL3Protocol::UpdateRawSocketProtocol (Ptr<RadeepRawSocketImpl> socket, uint16_t previous)
+{
+  NS_LOG_FUNCTION (this << socket << previous);
+  if (std::find (m_sockets.begin (), m_sockets.end (), socket) == m_sockets.end ())
+    {
+      // Not created by this stack, or already deleted
+      return;
+    }
+  if (previous < L4_DEMUX_SIZE)
+    {
+      m_socketsByProtocol[previous].remove (socket);
+    }
+  if (socket->GetProtocol () < L4_DEMUX_SIZE)
+    {
+      m_socketsByProtocol[socket->GetProtocol ()].push_back (socket);
+    }
+}
 /*
  * This method is called by AddAgregate and completes the aggregation
  * by setting the node in the Radeep stack
@@ -251,6 +340,7 @@ RadeepL3Protocol::SetRoutingProtocol (Ptr<RadeepRoutingProtocol> routingProtocol
   NS_LOG_FUNCTION (this << routingProtocol);
   m_routingProtocol = routingProtocol;
   m_routingProtocol->SetRadeep (this);
+  m_routeCache.clear ();
 }
 
 
@@ -270,6 +360,8 @@ RadeepL3Protocol::DoDispose (void)
       i->second = 0;
     }
   m_protocols.clear ();
+  m_l4Demux.assign (L4_DEMUX_SIZE, Ptr<RadeepL4Protocol> ());
+  m_interfaceL4Demux.clear ();
 
   for (RadeepInterfaceList::iterator i = m_interfaces.begin (); i != m_interfaces.end (); ++i)
     {
@@ -277,26 +369,34 @@ RadeepL3Protocol::DoDispose (void)
     }
   m_interfaces.clear ();
   m_reverseInterfacesContainer.clear ();
+  m_localAddressIndex.clear ();
+  m_broadcastAddressIndex.clear ();
+  m_prefixAddressIndex.clear ();
+  m_identification.clear ();
 
   m_sockets.clear ();
+  for (std::vector<SocketList>::iterator i = m_socketsByProtocol.begin (); i != m_socketsByProtocol.end (); ++i)
+    {
+      i->clear ();
+    }
   m_node = 0;
   m_routingProtocol = 0;
+  m_routeCache.clear ();
+  m_unicastForwardCallback.Nullify ();
+  m_multicastForwardCallback.Nullify ();
+  m_localDeliverCallback.Nullify ();
+  m_routeInputErrorCallback.Nullify ();
 
   for (MapFragments_t::iterator it = m_fragments.begin (); it != m_fragments.end (); it++)
     {
       it->second = 0;
     }
 
-  for (MapFragmentsTimers_t::iterator it = m_fragmentsTimers.begin (); it != m_fragmentsTimers.end (); it++)
-    {
-      if (it->second.IsRunning ())
-        {
-          it->second.Cancel ();
-        }
-    }
+  m_fragmentsTimer.Cancel ();
 
   m_fragments.clear ();
-  m_fragmentsTimers.clear ();
+  m_fragmentsAge.clear ();
+  m_fragmentBytes = 0;
 
   Object::DoDispose ();
 }
@@ -379,6 +479,10 @@ RadeepL3Protocol::AddRadeepInterface (Ptr<RadeepInterface>interface)
   uint32_t index = m_interfaces.size ();
   m_interfaces.push_back (interface);
   m_reverseInterfacesContainer[interface->GetDevice ()] = index;
+  for (uint32_t j = 0; j < interface->GetNAddresses (); j++)
+    {
+      IndexAddress (index, interface->GetAddress (j));
+    }
   return index;
 }
 
@@ -405,18 +509,10 @@ RadeepL3Protocol::GetInterfaceForAddress (
   RadeepAddress address) const
 {
   NS_LOG_FUNCTION (this << address);
-  int32_t interface = 0;
-  for (RadeepInterfaceList::const_iterator i = m_interfaces.begin (); 
-       i != m_interfaces.end (); 
-       i++, interface++)
+  AddressIndex::const_iterator it = m_localAddressIndex.find (address);
+  if (it != m_localAddressIndex.end ())
     {
-      for (uint32_t j = 0; j < (*i)->GetNAddresses (); j++)
-        {
-          if ((*i)->GetAddress (j).GetLocal () == address)
-            {
-              return interface;
-            }
-        }
+      return it->second.front ();
     }
 
   return -1;
@@ -428,21 +524,28 @@ RadeepL3Protocol::GetInterfaceForPrefix (
   RadeepMask mask) const
 {
   NS_LOG_FUNCTION (this << address << mask);
-  int32_t interface = 0;
-  for (RadeepInterfaceList::const_iterator i = m_interfaces.begin (); 
-       i != m_interfaces.end (); 
-       i++, interface++)
+  RadeepAddress network = address.CombineMask (mask);
+  SortedAddressIndex::const_iterator begin = m_prefixAddressIndex.begin ();
+  SortedAddressIndex::const_iterator end = m_prefixAddressIndex.end ();
+  uint32_t inverse = ~mask.Get ();
+  if ((inverse & (inverse + 1)) == 0)
     {
-      for (uint32_t j = 0; j < (*i)->GetNAddresses (); j++)
+      // With a contiguous mask, the addresses of the prefix are a range
+      begin = m_prefixAddressIndex.lower_bound (network);
+      end = m_prefixAddressIndex.upper_bound (RadeepAddress (network.Get () | inverse));
+    }
+
+  int32_t interface = -1;
+  for (SortedAddressIndex::const_iterator i = begin; i != end; i++)
+    {
+      if (i->first.CombineMask (mask) == network
+          && (interface == -1 || i->second.front () < uint32_t (interface)))
         {
-          if ((*i)->GetAddress (j).GetLocal ().CombineMask (mask) == address.CombineMask (mask))
-            {
-              return interface;
-            }
+          interface = i->second.front ();
         }
     }
 
-  return -1;
+  return interface;
 }
 
 int32_t 
@@ -464,20 +567,17 @@ bool
 RadeepL3Protocol::IsDestinationAddress (RadeepAddress address, uint32_t iif) const
 {
   NS_LOG_FUNCTION (this << address << iif);
-  // First check the incoming interface for a unicast address match
-  for (uint32_t i = 0; i < GetNAddresses (iif); i++)
+  // Check the addresses of the incoming interface, or of any interface
+  // with the weak ES model
+  if (IsOwnedBy (m_localAddressIndex, address, iif))
     {
-      RadeepInterfaceAddress iaddr = GetAddress (iif, i);
-      if (address == iaddr.GetLocal ())
-        {
-          NS_LOG_LOGIC ("For me (destination " << address << " match)");
-          return true;
-        }
-      if (address == iaddr.GetBroadcast ())
-        {
-          NS_LOG_LOGIC ("For me (interface broadcast address)");
-          return true;
-        }
+      NS_LOG_LOGIC ("For me (destination " << address << " match)");
+      return true;
+    }
+  if (IsOwnedBy (m_broadcastAddressIndex, address, iif))
+    {
+      NS_LOG_LOGIC ("For me (interface broadcast address)");
+      return true;
     }
 
   if (address.IsMulticast ())
@@ -498,31 +598,71 @@ RadeepL3Protocol::IsDestinationAddress (RadeepAddress address, uint32_t iif) con
       return true;
     }
 
-  if (GetWeakEsModel ())  // Check other interfaces
-    { 
-      for (uint32_t j = 0; j < GetNInterfaces (); j++)
-        {
-          if (j == uint32_t (iif)) continue;
-          for (uint32_t i = 0; i < GetNAddresses (j); i++)
-            {
-              RadeepInterfaceAddress iaddr = GetAddress (j, i);
-              if (address == iaddr.GetLocal ())
-                {
-                  NS_LOG_LOGIC ("For me (destination " << address << " match) on another interface");
-                  return true;
-                }
-              //  This is a small corner case:  match another interface's broadcast address
-              if (address == iaddr.GetBroadcast ())
-                {
-                  NS_LOG_LOGIC ("For me (interface broadcast address on another interface)");
-                  return true;
-                }
-            }
-        }
-    }
   return false;
 }
 
+bool
+RadeepL3Protocol::IsOwnedBy (const AddressIndex &index, RadeepAddress address, uint32_t iif) const
+{
+  AddressIndex::const_iterator it = index.find (address);
+  if (it == index.end ())
+    {
+      return false;
+    }
+  if (m_weakEsModel)
+    {
+      return true;
+    }
+  return std::binary_search (it->second.begin (), it->second.end (), iif);
+}
+
+void
+RadeepL3Protocol::IndexAddress (uint32_t interface, const RadeepInterfaceAddress &address)
+{
+  NS_LOG_FUNCTION (this << interface << address);
+  AddOwner (m_localAddressIndex, address.GetLocal (), interface);
+  AddOwner (m_broadcastAddressIndex, address.GetBroadcast (), interface);
+  AddOwner (m_prefixAddressIndex, address.GetLocal (), interface);
+}
+
+void
+RadeepL3Protocol::UnindexAddress (uint32_t interface, const RadeepInterfaceAddress &address)
+{
+  NS_LOG_FUNCTION (this << interface << address);
+  RemoveOwner (m_localAddressIndex, address.GetLocal (), interface);
+  RemoveOwner (m_broadcastAddressIndex, address.GetBroadcast (), interface);
+  RemoveOwner (m_prefixAddressIndex, address.GetLocal (), interface);
+}
+
+template <typename Index>
+void
+RadeepL3Protocol::AddOwner (Index &index, RadeepAddress address, uint32_t interface)
+{
+  AddressOwners &owners = index[address];
+  owners.insert (std::upper_bound (owners.begin (), owners.end (), interface), interface);
+}
+
+template <typename Index>
+void
+RadeepL3Protocol::RemoveOwner (Index &index, RadeepAddress address, uint32_t interface)
+{
+  typename Index::iterator it = index.find (address);
+  if (it == index.end ())
+    {
+      return;
+    }
+  AddressOwners &owners = it->second;
+  AddressOwners::iterator owner = std::lower_bound (owners.begin (), owners.end (), interface);
+  if (owner != owners.end () && *owner == interface)
+    {
+      owners.erase (owner);
+    }
+  if (owners.empty ())
+    {
+      index.erase (it);
+    }
+}
+
 void 
 RadeepL3Protocol::Receive ( Ptr<NetDevice> device, Ptr<const Packet> p, uint16_t protocol, const Address &from,
                           const Address &to, NetDevice::PacketType packetType)
@@ -542,14 +682,14 @@ RadeepL3Protocol::Receive ( Ptr<NetDevice> device, Ptr<const Packet> p, uint16_t
 
   if (radeepInterface->IsUp ())
     {
-      m_rxTrace (packet, m_node->GetObject<Radeep> (), interface);
+      m_rxTrace (packet, this, interface);
     }
   else
     {
       NS_LOG_LOGIC ("Dropping received packet -- interface is down");
       RadeepHeader radeepHeader;
       packet->RemoveHeader (radeepHeader);
-      m_dropTrace (radeepHeader, packet, DROP_INTERFACE_DOWN, m_node->GetObject<Radeep> (), interface);
+      m_dropTrace (radeepHeader, packet, DROP_INTERFACE_DOWN, this, interface);
       return;
     }
 
@@ -569,7 +709,7 @@ RadeepL3Protocol::Receive ( Ptr<NetDevice> device, Ptr<const Packet> p, uint16_t
   if (!radeepHeader.IsChecksumOk ()) 
     {
       NS_LOG_LOGIC ("Dropping received packet -- checksum not ok");
-      m_dropTrace (radeepHeader, packet, DROP_BAD_CHECKSUM, m_node->GetObject<Radeepv4> (), interface);
+      m_dropTrace (radeepHeader, packet, DROP_BAD_CHECKSUM, this, interface);
       return;
     }
 
@@ -603,7 +743,9 @@ RadeepL3Protocol::Receive ( Ptr<NetDevice> device, Ptr<const Packet> p, uint16_t
         }
     }
 
-  for (SocketList::iterator i = m_sockets.begin (); i != m_sockets.end (); ++i)
+  // Only the sockets of the packet protocol can match
+  SocketList &sockets = m_socketsByProtocol[radeepHeader.GetProtocol ()];
+  for (SocketList::iterator i = sockets.begin (); i != sockets.end (); ++i)
     {
       NS_LOG_LOGIC ("Forwarding to raw socket"); 
       Ptr<RadeepRawSocketImpl> socket = *i;
@@ -611,15 +753,17 @@ RadeepL3Protocol::Receive ( Ptr<NetDevice> device, Ptr<const Packet> p, uint16_t
     }
 
   NS_ASSERT_MSG (m_routingProtocol != 0, "Need a routing protocol object to process packets");
-  if (!m_routingProtocol->RouteInput (packet, radeepHeader, device,
-                                      MakeCallback (&RadeepL3Protocol::RadeepForward, this),
-                                      MakeCallback (&RadeepL3Protocol::RadeepMulticastForward, this),
-                                      MakeCallback (&RadeepL3Protocol::LocalDeliver, this),
-                                      MakeCallback (&RadeepL3Protocol::RouteInputError, this)
-                                      ))
+  RadeepRoutingProtocol::InputContext context (device, interface,
+                                               IsDestinationAddress (radeepHeader.GetDestination (), interface),
+                                               radeepHeader);
+  if (!m_routingProtocol->RouteInputWithContext (packet, radeepHeader, context,
+                                                 m_unicastForwardCallback,
+                                                 m_multicastForwardCallback,
+                                                 m_localDeliverCallback,
+                                                 m_routeInputErrorCallback))
     {
       NS_LOG_WARN ("No route found for forwarding packet.  Drop.");
-      m_dropTrace (radeepHeader, packet, DROP_NO_ROUTE, m_node->GetObject<Radeep> (), interface);
+      m_dropTrace (radeepHeader, packet, DROP_NO_ROUTE, this, interface);
     }
 }
 
@@ -688,12 +832,15 @@ RadeepL3Protocol::SendWithHeader (Ptr<Packet> packet,
 }
 
 void
-RadeepL3Protocol::CallTxTrace (const RadeepHeader & radeepHeader, Ptr<Packet> packet,
-                                    Ptr<Radeep> radeep, uint32_t interface)
+RadeepL3Protocol::CallTxTrace (const RadeepHeader & radeepHeader, Ptr<Packet> packet, uint32_t interface)
 {
+  if (m_txTrace.IsEmpty ())
+    {
+      return;
+    }
   Ptr<Packet> packetCopy = packet->Copy ();
   packetCopy->AddHeader (radeepHeader);
-  m_txTrace (packetCopy, radeep, interface);
+  m_txTrace (packetCopy, this, interface);
 }
 
 void 
@@ -759,7 +906,7 @@ RadeepL3Protocol::Send (Ptr<Packet> packet,
               NS_ASSERT (packetCopy->GetSize () <= outInterface->GetDevice ()->GetMtu ());
 
               m_sendOutgoingTrace (radeepHeader, packetCopy, ifaceIndex);
-              CallTxTrace (radeepHeader, packetCopy, m_node->GetObject<Radeep> (), ifaceIndex);
+              CallTxTrace (radeepHeader, packetCopy, ifaceIndex);
               outInterface->Send (packetCopy, radeepHeader, destination);
             }
         }
@@ -783,7 +930,7 @@ RadeepL3Protocol::Send (Ptr<Packet> packet,
               radeepHeader = BuildHeader (source, destination, protocol, packet->GetSize (), ttl, tos, mayFragment);
               Ptr<Packet> packetCopy = packet->Copy ();
               m_sendOutgoingTrace (radeepHeader, packetCopy, ifaceIndex);
-              CallTxTrace (radeepHeader, packetCopy, m_node->GetObject<Radeep> (), ifaceIndex);
+              CallTxTrace (radeepHeader, packetCopy, ifaceIndex);
               outInterface->Send (packetCopy, radeepHeader, destination);
               return;
             }
@@ -818,7 +965,7 @@ RadeepL3Protocol::Send (Ptr<Packet> packet,
   Ptr<RadeepRoute> newRoute;
   if (m_routingProtocol != 0)
     {
-      newRoute = m_routingProtocol->RouteOutput (packet, radeepHeader, oif, errno_);
+      newRoute = CachedRouteOutput (packet, radeepHeader, oif, errno_);
     }
   else
     {
@@ -833,10 +980,75 @@ RadeepL3Protocol::Send (Ptr<Packet> packet,
   else
     {
       NS_LOG_WARN ("No route to host.  Drop.");
-      m_dropTrace (radeepHeader, packet, DROP_NO_ROUTE, m_node->GetObject<Radeep> (), 0);
+      m_dropTrace (radeepHeader, packet, DROP_NO_ROUTE, this, 0);
     }
 }
 
+Ptr<RadeepRoute>
+RadeepL3Protocol::CachedRouteOutput (Ptr<Packet> packet, const RadeepHeader &header,
+                                     Ptr<NetDevice> oif, Socket::SocketErrno &sockerr)
+{
+  NS_LOG_FUNCTION (this << packet << header << oif);
+  NS_ASSERT (m_routingProtocol != 0);
+  RadeepAddress destination = header.GetDestination ();
+  if (m_routeCacheSize == 0 || destination.IsMulticast ()
+      || !m_routingProtocol->IsRouteOutputCacheable ())
+    {
+      return m_routingProtocol->RouteOutput (packet, header, oif, sockerr);
+    }
+
+  uint32_t generation = m_routingProtocol->GetGeneration ();
+  if (generation != m_routeCacheGeneration)
+    {
+      NS_LOG_LOGIC ("Routing table changed, flushing " << m_routeCache.size () << " cached routes");
+      m_routeCache.clear ();
+      m_routeCacheGeneration = generation;
+    }
+
+  uint64_t key = (uint64_t (destination.Get ()) << 32)
+    | (oif != 0 ? uint64_t (oif->GetIfIndex ()) + 1 : 0);
+  RouteCache::const_iterator it = m_routeCache.find (key);
+  if (it != m_routeCache.end ())
+    {
+      sockerr = Socket::ERROR_NOTERROR;
+      return it->second;
+    }
+
+  Ptr<RadeepRoute> route = m_routingProtocol->RouteOutput (packet, header, oif, sockerr);
+  if (route != 0)
+    {
+      if (m_routeCache.size () >= m_routeCacheSize)
+        {
+          m_routeCache.clear ();
+        }
+      m_routeCache[key] = route;
+    }
+  return route;
+}
+
+uint16_t &
+RadeepL3Protocol::GetIdentificationCounter (RadeepAddress source,
+                                            RadeepAddress destination,
+                                            uint8_t protocol)
+{
+  if (m_identification.size () != m_identificationBuckets)
+    {
+      // Sized on first use, the attribute is set after construction
+      m_identification.assign (m_identificationBuckets, 0);
+    }
+
+  // 64-bit finalizer of MurmurHash3, spreads nearby addresses over the table
+  uint64_t key = (uint64_t (source.Get ()) << 32) | destination.Get ();
+  key ^= uint64_t (protocol) * 0x9e3779b97f4a7c15ULL;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+
+  return m_identification[key % m_identificationBuckets];
+}
+
 // \todo when should we set Radeep_id?   check whether we are incrementing
 // m_identification on packets that may later be dropped in this stack
 // and whether that deviates from Linux
@@ -859,16 +1071,13 @@ RadeepL3Protocol::BuildHeader (
   radeepHeader.SetTtl (ttl);
   radeepHeader.SetTos (tos);
 
-  uint64_t src = source.Get ();
-  uint64_t dst = destination.Get ();
-  uint64_t srcDst = dst | (src << 32);
-  std::pair<uint64_t, uint8_t> key = std::make_pair (srcDst, protocol);
+  uint16_t &identification = GetIdentificationCounter (source, destination, protocol);
 
   if (mayFragment == true)
     {
       radeepHeader.SetMayFragment ();
-      radeepHeader.SetIdentification (m_identification[key]);
-      m_identification[key]++;
+      radeepHeader.SetIdentification (identification);
+      identification++;
     }
   else
     {
@@ -877,8 +1086,8 @@ RadeepL3Protocol::BuildHeader (
       // identification requirement:
       // >> Originating sources MAY set the Radeep ID field of atomic datagrams
       //    to any value.
-      radeepHeader.SetIdentification (m_identification[key]);
-      m_identification[key]++;
+      radeepHeader.SetIdentification (identification);
+      identification++;
     }
   if (Node::ChecksumEnabled ())
     {
@@ -896,7 +1105,7 @@ RadeepL3Protocol::SendRealOut (Ptr<RadeepRoute> route,
   if (route == 0)
     {
       NS_LOG_WARN ("No route to host.  Drop.");
-      m_dropTrace (radeepHeader, packet, DROP_NO_ROUTE, m_node->GetObject<Radeep> (), 0);
+      m_dropTrace (radeepHeader, packet, DROP_NO_ROUTE, this, 0);
       return;
     }
   Ptr<NetDevice> outDev = route->GetOutputDevice ();
@@ -912,24 +1121,24 @@ RadeepL3Protocol::SendRealOut (Ptr<RadeepRoute> route,
           NS_LOG_LOGIC ("Send to gateway " << route->GetGateway ());
           if ( packet->GetSize () + radeepHeader.GetSerializedSize () > outInterface->GetDevice ()->GetMtu () )
             {
-              std::list<RadeepPayloadHeaderPair> listFragments;
+              RadeepFragments_t listFragments;
               DoFragmentation (packet, radeepHeader, outInterface->GetDevice ()->GetMtu (), listFragments);
-              for ( std::list<RadeepPayloadHeaderPair>::iterator it = listFragments.begin (); it != listFragments.end (); it++ )
+              for ( RadeepFragments_t::iterator it = listFragments.begin (); it != listFragments.end (); it++ )
                 {
-                  CallTxTrace (it->second, it->first, m_node->GetObject<Radeep> (), interface);
+                  CallTxTrace (it->second, it->first, interface);
                   outInterface->Send (it->first, it->second, route->GetGateway ());
                 }
             }
           else
             {
-              CallTxTrace (radeepHeader, packet, m_node->GetObject<Radeep> (), interface);
+              CallTxTrace (radeepHeader, packet, interface);
               outInterface->Send (packet, radeepHeader, route->GetGateway ());
             }
         }
       else
         {
           NS_LOG_LOGIC ("Dropping -- outgoing interface is down: " << route->GetGateway ());
-          m_dropTrace (radeepHeader, packet, DROP_INTERFACE_DOWN, m_node->GetObject<Radeep> (), interface);
+          m_dropTrace (radeepHeader, packet, DROP_INTERFACE_DOWN, this, interface);
         }
     } 
   else 
@@ -939,25 +1148,25 @@ RadeepL3Protocol::SendRealOut (Ptr<RadeepRoute> route,
           NS_LOG_LOGIC ("Send to destination " << radeepHeader.GetDestination ());
           if ( packet->GetSize () + radeepHeader.GetSerializedSize () > outInterface->GetDevice ()->GetMtu () )
             {
-              std::list<RadeepPayloadHeaderPair> listFragments;
+              RadeepFragments_t listFragments;
               DoFragmentation (packet, radeepHeader, outInterface->GetDevice ()->GetMtu (), listFragments);
-              for ( std::list<RadeepPayloadHeaderPair>::iterator it = listFragments.begin (); it != listFragments.end (); it++ )
+              for ( RadeepFragments_t::iterator it = listFragments.begin (); it != listFragments.end (); it++ )
                 {
                   NS_LOG_LOGIC ("Sending fragment " << *(it->first) );
-                  CallTxTrace (it->second, it->first, m_node->GetObject<Radeep> (), interface);
+                  CallTxTrace (it->second, it->first, interface);
                   outInterface->Send (it->first, it->second, radeepHeader.GetDestination ());
                 }
             }
           else
             {
-              CallTxTrace (radeepHeader, packet, m_node->GetObject<Radeep> (), interface);
+              CallTxTrace (radeepHeader, packet, interface);
               outInterface->Send (packet, radeepHeader, radeepHeader.GetDestination ());
             }
         }
       else
         {
           NS_LOG_LOGIC ("Dropping -- outgoing interface is down: " << radeepHeader.GetDestination ());
-          m_dropTrace (radeepHeader, packet, DROP_INTERFACE_DOWN, m_node->GetObject<Radeep> (), interface);
+          m_dropTrace (radeepHeader, packet, DROP_INTERFACE_DOWN, this, interface);
         }
     }
 }
@@ -977,15 +1186,16 @@ RadeepL3Protocol::RadeepMulticastForward (Ptr<RadeepMulticastRoute> mrtentry, Pt
       uint32_t interfaceId = mapIter->first;
       //uint32_t outputTtl = mapIter->second;  // Unused for now
 
-      Ptr<Packet> packet = p->Copy ();
       RadeepHeader h = header;
-      h.SetTtl (header.GetTtl () - 1);
+      h.DecrementTtl ();
       if (h.GetTtl () == 0)
         {
           NS_LOG_WARN ("TTL exceeded.  Drop.");
-          m_dropTrace (header, packet, DROP_TTL_EXPIRED, m_node->GetObject<Radeep> (), interfaceId);
+          m_dropTrace (header, p, DROP_TTL_EXPIRED, this, interfaceId);
           return;
         }
+      // One copy per output interface, as each one gets its own header
+      Ptr<Packet> packet = p->Copy ();
       NS_LOG_LOGIC ("Forward multicast via interface " << interfaceId);
       Ptr<RadeepRoute> rtentry = Create<RadeepRoute> ();
       rtentry->SetSource (h.GetSource ());
@@ -1005,9 +1215,8 @@ RadeepL3Protocol::RadeepForward (Ptr<RadeepRoute> rtentry, Ptr<const Packet> p,
   NS_LOG_LOGIC ("Forwarding logic for node: " << m_node->GetId ());
   // Forwarding
   RadeepHeader radeepHeader = header;
-  Ptr<Packet> packet = p->Copy ();
   int32_t interface = GetInterfaceForDevice (rtentry->GetOutputDevice ());
-  radeepHeader.SetTtl (radeepHeader.GetTtl () - 1);
+  radeepHeader.DecrementTtl ();
   if (radeepHeader.GetTtl () == 0)
     {
       // Do not reply to ICMP or to multicast/broadcast Radeep address 
@@ -1016,12 +1225,15 @@ RadeepL3Protocol::RadeepForward (Ptr<RadeepRoute> rtentry, Ptr<const Packet> p,
           radeepHeader.GetDestination ().IsMulticast () == false)
         {
           Ptr<Icmpv4L4Protocol> icmp = GetIcmp ();
-          icmp->SendTimeExceededTtl (radeepHeader, packet, false);
+          icmp->SendTimeExceededTtl (radeepHeader, p, false);
         }
       NS_LOG_WARN ("TTL exceeded.  Drop.");
-      m_dropTrace (header, packet, DROP_TTL_EXPIRED, m_node->GetObject<Radeep> (), interface);
+      m_dropTrace (header, p, DROP_TTL_EXPIRED, this, interface);
       return;
     }
+  // The routing protocol may still hold the packet, so only copy it
+  // now that it is going to be modified
+  Ptr<Packet> packet = p->Copy ();
   // in case the packet still has a priority tag attached, remove it
   SocketPriorityTag priorityTag;
   packet->RemovePacketTag (priorityTag);
@@ -1042,6 +1254,8 @@ RadeepL3Protocol::LocalDeliver (Ptr<const Packet> packet, RadeepHeader const&rad
 {
   NS_LOG_FUNCTION (this << packet << &radeep << iif);
   Ptr<Packet> p = packet->Copy (); // need to pass a non-const packet up
+  // The L4 protocol consumes p; keep what an ICMP error would quote
+  Ptr<const Packet> original = packet;
   RadeepHeader radeepHeader = radeep;
 
   if ( !radeepHeader.IsLastFragment () || radeepHeader.GetFragmentOffset () != 0 )
@@ -1056,6 +1270,7 @@ RadeepL3Protocol::LocalDeliver (Ptr<const Packet> packet, RadeepHeader const&rad
       NS_LOG_LOGIC ("Got last fragment, Packet is complete " << *p );
       radeepHeader.SetFragmentOffset (0);
       radeepHeader.SetPayloadSize (p->GetSize ());
+      original = 0;
     }
 
   m_localDeliverTrace (radeepHeader, p, iif);
@@ -1064,8 +1279,12 @@ RadeepL3Protocol::LocalDeliver (Ptr<const Packet> packet, RadeepHeader const&rad
   if (protocol != 0)
     {
       // we need to make a copy in the unlikely event we hit the
-      // RX_ENDPOINT_UNREACH codepath
-      Ptr<Packet> copy = p->Copy ();
+      // RX_ENDPOINT_UNREACH codepath; the received packet is left
+      // untouched, so only a reassembled packet has to be copied
+      if (original == 0)
+        {
+          original = p->Copy ();
+        }
       enum RadeepL4Protocol::RxStatus status = 
         protocol->Receive (p, radeepHeader, GetInterface (iif));
       switch (status) {
@@ -1094,7 +1313,7 @@ RadeepL3Protocol::LocalDeliver (Ptr<const Packet> packet, RadeepHeader const&rad
             }
           if (subnetDirected == false)
             {
-              GetIcmp ()->SendDestUnreachPort (radeepHeader, copy);
+              GetIcmp ()->SendDestUnreachPort (radeepHeader, original);
             }
         }
     }
@@ -1106,6 +1325,10 @@ RadeepL3Protocol::AddAddress (uint32_t i, RadeepInterfaceAddress address)
   NS_LOG_FUNCTION (this << i << address);
   Ptr<RadeepInterface> interface = GetInterface (i);
   bool retVal = interface->AddAddress (address);
+  if (retVal)
+    {
+      IndexAddress (i, address);
+    }
   if (m_routingProtocol != 0)
     {
       m_routingProtocol->NotifyAddAddress (i, address);
@@ -1137,6 +1360,7 @@ RadeepL3Protocol::RemoveAddress (uint32_t i, uint32_t addressIndex)
   RadeepInterfaceAddress address = interface->RemoveAddress (addressIndex);
   if (address != RadeepInterfaceAddress ())
     {
+      UnindexAddress (i, address);
       if (m_routingProtocol != 0)
         {
           m_routingProtocol->NotifyRemoveAddress (i, address);
@@ -1160,6 +1384,7 @@ RadeepL3Protocol::RemoveAddress (uint32_t i, RadeepAddress address)
   RadeepInterfaceAddress ifAddr = interface->RemoveAddress (address);
   if (ifAddr != RadeepInterfaceAddress ())
     {
+      UnindexAddress (i, ifAddr);
       if (m_routingProtocol != 0)
         {
           m_routingProtocol->NotifyRemoveAddress (i, ifAddr);
@@ -1380,13 +1605,13 @@ RadeepL3Protocol::RouteInputError (Ptr<const Packet> p, const RadeepHeader & rad
 {
   NS_LOG_FUNCTION (this << p << radeepHeader << sockErrno);
   NS_LOG_LOGIC ("Route input failure-- dropping packet to " << radeepHeader << " with errno " << sockErrno); 
-  m_dropTrace (radeepHeader, p, DROP_ROUTE_ERROR, m_node->GetObject<Radeep> (), 0);
+  m_dropTrace (radeepHeader, p, DROP_ROUTE_ERROR, this, 0);
 
   // \todo Send an ICMP no route.
 }
 
 void
-RadeepL3Protocol::DoFragmentation (Ptr<Packet> packet, const RadeepHeader & radeepHeader, uint32_t outIfaceMtu, std::list<RadeepPayloadHeaderPair>& listFragments)
+RadeepL3Protocol::DoFragmentation (Ptr<const Packet> packet, const RadeepHeader & radeepHeader, uint32_t outIfaceMtu, RadeepFragments_t& listFragments)
 {
   // BEWARE: here we do assume that the header options are not present.
   // a much more complex handling is necessary in case there are options.
@@ -1395,15 +1620,15 @@ RadeepL3Protocol::DoFragmentation (Ptr<Packet> packet, const RadeepHeader & rade
 
   NS_LOG_FUNCTION (this << *packet << outIfaceMtu << &listFragments);
 
-  Ptr<Packet> p = packet->Copy ();
-
   NS_ASSERT_MSG( (radeepHeader.GetSerializedSize() == 5*4),
                  "Radeep fragmentation implementation only works without option headers." );
 
+  uint32_t packetSize = packet->GetSize ();
   uint16_t offset = 0;
   bool moreFragment = true;
   uint16_t originalOffset = radeepHeader.GetFragmentOffset();
   bool isLastFragment = radeepHeader.IsLastFragment();
+  bool checksumEnabled = Node::ChecksumEnabled ();
   uint32_t currentFragmentablePartSize = 0;
 
   // Radeep fragments are all 8 bytes aligned but the last.
@@ -1413,11 +1638,13 @@ RadeepL3Protocol::DoFragmentation (Ptr<Packet> packet, const RadeepHeader & rade
 
   NS_LOG_LOGIC ("Fragmenting - Target Size: " << fragmentSize );
 
+  listFragments.reserve (listFragments.size () + (packetSize + fragmentSize - 1) / fragmentSize);
+
   do
     {
       RadeepHeader fragmentHeader = radeepHeader;
 
-      if (p->GetSize () > offset + fragmentSize )
+      if (packetSize > offset + fragmentSize )
         {
           moreFragment = true;
           currentFragmentablePartSize = fragmentSize;
@@ -1426,7 +1653,7 @@ RadeepL3Protocol::DoFragmentation (Ptr<Packet> packet, const RadeepHeader & rade
       else
         {
           moreFragment = false;
-          currentFragmentablePartSize = p->GetSize () - offset;
+          currentFragmentablePartSize = packetSize - offset;
           if (!isLastFragment)
             {
               fragmentHeader.SetMoreFragments ();
@@ -1438,25 +1665,19 @@ RadeepL3Protocol::DoFragmentation (Ptr<Packet> packet, const RadeepHeader & rade
         }
 
       NS_LOG_LOGIC ("Fragment creation - " << offset << ", " << currentFragmentablePartSize  );
-      Ptr<Packet> fragment = p->CreateFragment (offset, currentFragmentablePartSize);
+      // CreateFragment does not copy the bytes, the fragment refers to the packet buffer
+      Ptr<Packet> fragment = packet->CreateFragment (offset, currentFragmentablePartSize);
       NS_LOG_LOGIC ("Fragment created - " << offset << ", " << fragment->GetSize ()  );
 
       fragmentHeader.SetFragmentOffset (offset+originalOffset);
       fragmentHeader.SetPayloadSize (currentFragmentablePartSize);
 
-      if (Node::ChecksumEnabled ())
+      if (checksumEnabled)
         {
           fragmentHeader.EnableChecksum ();
         }
 
-      NS_LOG_LOGIC ("Fragment check - " << fragmentHeader.GetFragmentOffset ()  );
-
       NS_LOG_LOGIC ("New fragment Header " << fragmentHeader);
-
-      std::ostringstream oss;
-      oss << fragmentHeader;
-      fragment->Print (oss);
-
       NS_LOG_LOGIC ("New fragment " << *fragment);
 
       listFragments.push_back (RadeepPayloadHeaderPair (fragment, fragmentHeader));
@@ -1488,11 +1709,15 @@ RadeepL3Protocol::ProcessFragment (Ptr<Packet>& packet, RadeepHeader& radeepHead
   MapFragments_t::iterator it = m_fragments.find (key);
   if (it == m_fragments.end ())
     {
-      fragments = Create<Fragments> ();
-      m_fragments.insert (std::make_pair (key, fragments));
-      m_fragmentsTimers[key] = Simulator::Schedule (m_fragmentExpirationTimeout,
-                                                    &RadeepL3Protocol::HandleFragmentsTimeout, this,
-                                                    key, radeepHeader, iif);
+      fragments = Create<Fragments> (radeepHeader, iif);
+      fragments->SetAge (m_fragmentsAge.insert (m_fragmentsAge.end (), key));
+      fragments->SetExpiration (Simulator::Now () + m_fragmentExpirationTimeout);
+      it = m_fragments.insert (std::make_pair (key, fragments)).first;
+      if (!m_fragmentsTimer.IsRunning ())
+        {
+          m_fragmentsTimer = Simulator::Schedule (m_fragmentExpirationTimeout,
+                                                  &RadeepL3Protocol::HandleFragmentsTimeout, this);
+        }
     }
   else
     {
@@ -1501,29 +1726,91 @@ RadeepL3Protocol::ProcessFragment (Ptr<Packet>& packet, RadeepHeader& radeepHead
 
   NS_LOG_LOGIC ("Adding fragment - Size: " << packet->GetSize ( ) << " - Offset: " << (radeepHeader.GetFragmentOffset ()) );
 
-  fragments->AddFragment (p, radeepHeader.GetFragmentOffset (), !radeepHeader.IsLastFragment () );
+  if (!fragments->AddFragment (p, radeepHeader.GetFragmentOffset (), !radeepHeader.IsLastFragment ()))
+    {
+      NS_LOG_LOGIC ("Dropping fragment inconsistent with the end of the packet");
+      m_dropTrace (radeepHeader, packet, DROP_FRAGMENT_INCONSISTENT, this, iif);
+      return false;
+    }
+  m_fragmentBytes += p->GetSize ();
 
   if ( fragments->IsEntire () )
     {
+      NS_LOG_LOGIC ("Stopping WaitFragmentsTimer at " << Simulator::Now ().GetSeconds () << " due to complete packet");
       packet = fragments->GetPacket ();
-      fragments = 0;
-      m_fragments.erase (key);
-      if (m_fragmentsTimers[key].IsRunning ())
-        {
-          NS_LOG_LOGIC ("Stopping WaitFragmentsTimer at " << Simulator::Now ().GetSeconds () << " due to complete packet");
-          m_fragmentsTimers[key].Cancel ();
-        }
-      m_fragmentsTimers.erase (key);
+      RemoveFragments (it);
       ret = true;
     }
+  else
+    {
+      EvictFragments ();
+    }
 
   return ret;
 }
 
-RadeepL3Protocol::Fragments::Fragments ()
-  : m_moreFragment (0)
+void
+RadeepL3Protocol::RemoveFragments (MapFragments_t::iterator it)
+{
+  NS_LOG_FUNCTION (this);
+  m_fragmentBytes -= it->second->GetSize ();
+  m_fragmentsAge.erase (it->second->GetAge ());
+  it->second = 0;
+  m_fragments.erase (it);
+  if (m_fragmentsAge.empty ())
+    {
+      m_fragmentsTimer.Cancel ();
+    }
+}
+
+void
+RadeepL3Protocol::EvictFragments (void)
+{
+  NS_LOG_FUNCTION (this);
+  while (m_fragmentMemoryLimit > 0 && m_fragmentBytes > m_fragmentMemoryLimit)
+    {
+      NS_ASSERT (!m_fragmentsAge.empty ());
+      MapFragments_t::iterator it = m_fragments.find (m_fragmentsAge.front ());
+      NS_ASSERT (it != m_fragments.end ());
+      NS_LOG_LOGIC ("Evicting fragments holding " << it->second->GetSize () << " bytes");
+      m_fragmentEvictions++;
+      m_dropTrace (it->second->GetHeader (), it->second->GetPartialPacket (), DROP_FRAGMENT_EVICTED,
+                   this, it->second->GetInterface ());
+      RemoveFragments (it);
+    }
+}
+
+uint64_t
+RadeepL3Protocol::GetFragmentBytes (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_fragmentBytes;
+}
+
+uint64_t
+RadeepL3Protocol::GetFragmentEvictions (void) const
 {
   NS_LOG_FUNCTION (this);
+  return m_fragmentEvictions;
+}
+
+uint64_t
+RadeepL3Protocol::GetFragmentTimeouts (void) const
+{
+  NS_LOG_FUNCTION (this);
+  return m_fragmentTimeouts;
+}
+
+RadeepL3Protocol::Fragments::Fragments (const RadeepHeader &header, uint32_t iif)
+  : m_header (header),
+    m_iif (iif),
+    m_size (0),
+    m_end (std::numeric_limits<uint32_t>::max ()),
+    m_dataEnd (0)
+{
+  NS_LOG_FUNCTION (this << header << iif);
+  // Until the last fragment is received, the packet size is unknown
+  m_holes.push_back (Hole (0, m_end));
 }
 
 RadeepL3Protocol::Fragments::~Fragments ()
@@ -1531,57 +1818,126 @@ RadeepL3Protocol::Fragments::~Fragments ()
   NS_LOG_FUNCTION (this);
 }
 
-void
+bool
 RadeepL3Protocol::Fragments::AddFragment (Ptr<Packet> fragment, uint16_t fragmentOffset, bool moreFragment)
 {
   NS_LOG_FUNCTION (this << fragment << fragmentOffset << moreFragment);
 
-  std::list<std::pair<Ptr<Packet>, uint16_t> >::iterator it;
+  uint32_t first = fragmentOffset;
+  uint32_t last = first + fragment->GetSize ();
 
-  for (it = m_fragments.begin (); it != m_fragments.end (); it++)
+  if (last > m_end)
+    {
+      NS_LOG_LOGIC ("Fragment goes past the end of the packet, " << m_end);
+      return false;
+    }
+  if (!moreFragment)
     {
-      if (it->second > fragmentOffset)
+      if (m_end != std::numeric_limits<uint32_t>::max () && last != m_end)
         {
-          break;
+          NS_LOG_LOGIC ("Last fragment ends at " << last << " instead of " << m_end);
+          return false;
+        }
+      if (m_dataEnd > last)
+        {
+          NS_LOG_LOGIC ("Last fragment ends before data received up to " << m_dataEnd);
+          return false;
         }
+      m_end = last;
     }
 
-  if (it == m_fragments.end ())
+  // Inserted after the fragments with the same offset
+  m_fragments.insert (FragmentsByOffset::value_type (fragmentOffset, fragment));
+  m_size += fragment->GetSize ();
+  m_dataEnd = std::max (m_dataEnd, last);
+
+  // RFC 815: shrink, split or remove each hole overlapping the fragment.
+  // Once the last fragment is received, the holes beyond the end of the
+  // packet are closed too.
+  std::vector<Hole>::iterator it = m_holes.begin ();
+  while (it != m_holes.end ())
     {
-      m_moreFragment = moreFragment;
+      it->second = std::min (it->second, m_end);
+      if (it->first >= it->second)
+        {
+          it = m_holes.erase (it);
+        }
+      else if (it->second <= first || it->first >= last)
+        {
+          it++;
+        }
+      else if (it->first < first && it->second > last)
+        {
+          uint32_t holeEnd = it->second;
+          it->second = first;
+          it = m_holes.insert (it + 1, Hole (last, holeEnd));
+          it++;
+        }
+      else if (it->first < first)
+        {
+          it->second = first;
+          it++;
+        }
+      else if (it->second > last)
+        {
+          it->first = last;
+          it++;
+        }
+      else
+        {
+          it = m_holes.erase (it);
+        }
     }
+  return true;
+}
 
-  m_fragments.insert (it, std::pair<Ptr<Packet>, uint16_t> (fragment, fragmentOffset));
+uint32_t
+RadeepL3Protocol::Fragments::GetSize () const
+{
+  return m_size;
 }
 
-bool
-RadeepL3Protocol::Fragments::IsEntire () const
+const RadeepHeader &
+RadeepL3Protocol::Fragments::GetHeader () const
 {
-  NS_LOG_FUNCTION (this);
+  return m_header;
+}
 
-  bool ret = !m_moreFragment && m_fragments.size () > 0;
+uint32_t
+RadeepL3Protocol::Fragments::GetInterface () const
+{
+  return m_iif;
+}
 
-  if (ret)
-    {
-      uint16_t lastEndOffset = 0;
+void
+RadeepL3Protocol::Fragments::SetAge (std::list<std::pair<uint64_t, uint32_t> >::iterator age)
+{
+  m_age = age;
+}
 
-      for (std::list<std::pair<Ptr<Packet>, uint16_t> >::const_iterator it = m_fragments.begin (); it != m_fragments.end (); it++)
-        {
-          // overlapping fragments do exist
-          NS_LOG_LOGIC ("Checking overlaps " << lastEndOffset << " - " << it->second );
+std::list<std::pair<uint64_t, uint32_t> >::iterator
+RadeepL3Protocol::Fragments::GetAge () const
+{
+  return m_age;
+}
 
-          if (lastEndOffset < it->second)
-            {
-              ret = false;
-              break;
-            }
-          // fragments might overlap in strange ways
-          uint16_t fragmentEnd = it->first->GetSize () + it->second;
-          lastEndOffset = std::max ( lastEndOffset, fragmentEnd );
-        }
-    }
+void
+RadeepL3Protocol::Fragments::SetExpiration (Time expiration)
+{
+  m_expiration = expiration;
+}
 
-  return ret;
+Time
+RadeepL3Protocol::Fragments::GetExpiration () const
+{
+  return m_expiration;
+}
+
+bool
+RadeepL3Protocol::Fragments::IsEntire () const
+{
+  NS_LOG_FUNCTION (this);
+  return m_holes.empty ();
 }
 
 Ptr<Packet>
@@ -1589,34 +1945,42 @@ RadeepL3Protocol::Fragments::GetPacket () const
 {
   NS_LOG_FUNCTION (this);
 
-  std::list<std::pair<Ptr<Packet>, uint16_t> >::const_iterator it = m_fragments.begin ();
+  FragmentsByOffset::const_iterator it = m_fragments.begin ();
 
-  Ptr<Packet> p = it->first->Copy ();
-  uint16_t lastEndOffset = p->GetSize ();
+  Ptr<Packet> p = it->second->Copy ();
+  if (p->GetSize () > m_end)
+    {
+      p->RemoveAtEnd (p->GetSize () - m_end);
+    }
+  uint32_t lastEndOffset = p->GetSize ();
   it++;
 
-  for ( ; it != m_fragments.end (); it++)
+  // Nothing past the end set by the last fragment is delivered
+  for ( ; it != m_fragments.end () && it->first < m_end; it++)
     {
-      if ( lastEndOffset > it->second )
+      uint32_t fragmentSize = it->second->GetSize ();
+      uint32_t fragmentEnd = std::min (uint32_t (it->first) + fragmentSize, m_end);
+      if ( lastEndOffset >= fragmentEnd )
+        {
+          // Entirely covered by the previous fragments
+          continue;
+        }
+      if ( lastEndOffset > it->first || fragmentEnd < it->first + fragmentSize )
         {
-          // The fragments are overlapping.
+          // The fragments are overlapping, or the fragment goes past the end.
           // We do not overwrite the "old" with the "new" because we do not know when each arrived.
           // This is different from what Linux does.
           // It is not possible to emulate a fragmentation attack.
-          uint32_t newStart = lastEndOffset - it->second;
-          if ( it->first->GetSize () > newStart )
-            {
-              uint32_t newSize = it->first->GetSize () - newStart;
-              Ptr<Packet> tempFragment = it->first->CreateFragment (newStart, newSize);
-              p->AddAtEnd (tempFragment);
-            }
+          uint32_t newStart = lastEndOffset - it->first;
+          Ptr<Packet> tempFragment = it->second->CreateFragment (newStart, fragmentEnd - lastEndOffset);
+          p->AddAtEnd (tempFragment);
         }
       else
         {
-          NS_LOG_LOGIC ("Adding: " << *(it->first) );
-          p->AddAtEnd (it->first);
+          NS_LOG_LOGIC ("Adding: " << *(it->second) );
+          p->AddAtEnd (it->second);
         }
-      lastEndOffset = p->GetSize ();
+      lastEndOffset = fragmentEnd;
     }
 
   return p;
@@ -1627,56 +1991,78 @@ RadeepL3Protocol::Fragments::GetPartialPacket () const
 {
   NS_LOG_FUNCTION (this);
   
-  std::list<std::pair<Ptr<Packet>, uint16_t> >::const_iterator it = m_fragments.begin ();
-
   Ptr<Packet> p = Create<Packet> ();
-  uint16_t lastEndOffset = 0;
+  uint32_t lastEndOffset = 0;
 
-  if ( m_fragments.begin ()->second > 0 )
+  if ( m_fragments.begin ()->first > 0 )
     {
       return p;
     }
 
-  for ( it = m_fragments.begin (); it != m_fragments.end (); it++)
+  for (FragmentsByOffset::const_iterator it = m_fragments.begin ();
+       it != m_fragments.end () && it->first < m_end; it++)
     {
-      if ( lastEndOffset > it->second )
+      uint32_t fragmentSize = it->second->GetSize ();
+      uint32_t fragmentEnd = std::min (uint32_t (it->first) + fragmentSize, m_end);
+      if ( lastEndOffset < it->first )
         {
-          uint32_t newStart = lastEndOffset - it->second;
-          uint32_t newSize = it->first->GetSize () - newStart;
-          Ptr<Packet> tempFragment = it->first->CreateFragment (newStart, newSize);
-          p->AddAtEnd (tempFragment);
+          // The rest is not contiguous
+          break;
+        }
+      if ( lastEndOffset >= fragmentEnd )
+        {
+          continue;
         }
-      else if ( lastEndOffset == it->second )
+      if ( lastEndOffset == it->first && fragmentEnd == it->first + fragmentSize )
         {
-          NS_LOG_LOGIC ("Adding: " << *(it->first) );
-          p->AddAtEnd (it->first);
+          NS_LOG_LOGIC ("Adding: " << *(it->second) );
+          p->AddAtEnd (it->second);
         }
-      lastEndOffset = p->GetSize ();
+      else
+        {
+          uint32_t newStart = lastEndOffset - it->first;
+          Ptr<Packet> tempFragment = it->second->CreateFragment (newStart, fragmentEnd - lastEndOffset);
+          p->AddAtEnd (tempFragment);
+        }
+      lastEndOffset = fragmentEnd;
     }
 
   return p;
 }
 
 void
-RadeepL3Protocol::HandleFragmentsTimeout (std::pair<uint64_t, uint32_t> key, RadeepHeader & radeepHeader, uint32_t iif)
+RadeepL3Protocol::HandleFragmentsTimeout (void)
 {
-  NS_LOG_FUNCTION (this << &key << &radeepHeader << iif);
-
-  MapFragments_t::iterator it = m_fragments.find (key);
-  Ptr<Packet> packet = it->second->GetPartialPacket ();
+  NS_LOG_FUNCTION (this);
 
-  // if we have at least 8 bytes, we can send an ICMP.
-  if ( packet->GetSize () > 8 )
+  // Should FragmentExpirationTimeout be shortened at run time, the packets
+  // created afterwards wait for the older ones to expire first.
+  while (!m_fragmentsAge.empty ())
     {
-      Ptr<Icmpv4L4Protocol> icmp = GetIcmp ();
-      icmp->SendTimeExceededTtl (radeepHeader, packet, true);
-    }
-  m_dropTrace (radeepHeader, packet, DROP_FRAGMENT_TIMEOUT, m_node->GetObject<Radeep> (), iif);
+      MapFragments_t::iterator it = m_fragments.find (m_fragmentsAge.front ());
+      NS_ASSERT (it != m_fragments.end ());
+      Ptr<Fragments> fragments = it->second;
+      if (fragments->GetExpiration () > Simulator::Now ())
+        {
+          m_fragmentsTimer = Simulator::Schedule (fragments->GetExpiration () - Simulator::Now (),
+                                                  &RadeepL3Protocol::HandleFragmentsTimeout, this);
+          return;
+        }
 
-  // clear the buffers
-  it->second = 0;
+      Ptr<Packet> packet = fragments->GetPartialPacket ();
+      const RadeepHeader &radeepHeader = fragments->GetHeader ();
+
+      // if we have at least 8 bytes, we can send an ICMP.
+      if ( packet->GetSize () > 8 )
+        {
+          Ptr<Icmpv4L4Protocol> icmp = GetIcmp ();
+          icmp->SendTimeExceededTtl (radeepHeader, packet, true);
+        }
+      m_dropTrace (radeepHeader, packet, DROP_FRAGMENT_TIMEOUT, this, fragments->GetInterface ());
+      m_fragmentTimeouts++;
 
-  m_fragments.erase (key);
-  m_fragmentsTimers.erase (key);
+      // clear the buffers
+      RemoveFragments (it);
+    }
 }
 } // namespace ns3
@@ -7,6 +7,7 @@
 #include <list>
 #include <map>
 #include <vector>
+#include <unordered_map>
 #include <stdint.h>
 #include "ns3/Radeep-address.h"
 #include "ns3/ptr.h"
@@ -84,7 +85,9 @@ public:
     DROP_BAD_CHECKSUM,   /**< Bad checksum */
     DROP_INTERFACE_DOWN,   /**< Interface is down so can not send packet */
     DROP_ROUTE_ERROR,   /**< Route error */
-    DROP_FRAGMENT_TIMEOUT /**< Fragment timeout exceeded */
+    DROP_FRAGMENT_TIMEOUT, /**< Fragment timeout exceeded */
+    DROP_FRAGMENT_EVICTED, /**< Fragments evicted to respect the reassembly memory limit */
+    DROP_FRAGMENT_INCONSISTENT /**< Fragment inconsistent with the end of the packet */
   };
 
   /**
@@ -101,6 +104,13 @@ public:
   Ptr<Socket> CreateRawSocket (void);
   void DeleteRawSocket (Ptr<Socket> socket);
 
+  /**
+   * \brief Move a raw socket to the index entry of its new protocol.
+   * \param socket the raw socket
+   * \param previous the protocol the socket was indexed with
+   */
+  void UpdateRawSocketProtocol (Ptr<RadeepRawSocketImpl> socket, uint16_t previous);
+
   virtual void Insert (Ptr<RadeepL4Protocol> protocol);
   virtual void Insert (Ptr<RadeepL4Protocol> protocol, uint32_t interfaceIndex);
 
@@ -120,6 +130,23 @@ public:
    */
   void SetDefaultTtl (uint8_t ttl);
 
+  /**
+   * \return the number of bytes currently held in the reassembly buffers
+   */
+  uint64_t GetFragmentBytes (void) const;
+
+  /**
+   * \return the number of incomplete packets evicted from the reassembly
+   * buffers to respect the FragmentMemoryLimit
+   */
+  uint64_t GetFragmentEvictions (void) const;
+
+  /**
+   * \return the number of incomplete packets dropped from the reassembly
+   * buffers because the FragmentExpirationTimeout expired
+   */
+  uint64_t GetFragmentTimeouts (void) const;
+
   /**
    * Lower layer calls this method after calling L3Demux::Lookup
    * The ARP subclass needs to know from which NetDevice this
@@ -158,6 +185,23 @@ public:
    */
   void SendWithHeader (Ptr<Packet> packet, RadeepHeader radeepHeader, Ptr<RadeepRoute> route);
 
+  /**
+   * \brief Get a route for a locally originated packet.
+   *
+   * Asks the routing protocol through a destination cache keyed by
+   * destination and output device.  The cache is only used if the
+   * routing protocol allows it, and is emptied when the generation of the
+   * routing protocol changes.
+   *
+   * \param packet packet to send
+   * \param header Radeep header of the packet
+   * \param oif output device requested, or 0
+   * \param sockerr error reported by the routing protocol
+   * \return the route, or 0 if there is none
+   */
+  Ptr<RadeepRoute> CachedRouteOutput (Ptr<Packet> packet, const RadeepHeader &header,
+                                      Ptr<NetDevice> oif, Socket::SocketErrno &sockerr);
+
   uint32_t AddInterface (Ptr<NetDevice> device);
   /**
    * \brief Get an interface.
@@ -279,6 +323,24 @@ private:
   virtual void SetWeakEsModel (bool model);
   virtual bool GetWeakEsModel (void) const;
 
+  /**
+   * \brief Get the identification counter of a flow.
+   *
+   * Flows are hashed onto a fixed number of counters, so the memory used
+   * does not grow with the number of peers.  Flows sharing a counter wrap
+   * it together, after 65536 packets in total, and so reuse their
+   * identifications sooner than with a counter of their own: RFC 6864
+   * accepts this trade-off for hashed counters.
+   *
+   * \param source source address
+   * \param destination destination address
+   * \param protocol L4 protocol
+   * \return the counter to use and increment
+   */
+  uint16_t &GetIdentificationCounter (RadeepAddress source,
+                                      RadeepAddress destination,
+                                      uint8_t protocol);
+
   /**
    * \brief Construct an Radeep header.
    * \param source source Radeep address
@@ -379,14 +441,22 @@ private:
    */
   typedef std::pair<Ptr<Packet>, RadeepHeader> RadeepPayloadHeaderPair;
 
+  /**
+   * \brief Container of fragments and their Radeep headers, in offset order.
+   */
+  typedef std::vector<RadeepPayloadHeaderPair> RadeepFragments_t;
+
   /**
    * \brief Fragment a packet
+   *
+   * The fragments share the buffer of the packet, which is left unchanged.
+   *
    * \param packet the packet
    * \param RadeepHeader the Radeep header
    * \param outIfaceMtu the MTU of the interface
-   * \param listFragments the list of fragments
+   * \param listFragments the fragments, appended to the container
    */
-  void DoFragmentation (Ptr<Packet> packet, const RadeepHeader& RadeepHeader, uint32_t outIfaceMtu, std::list<RadeepPayloadHeaderPair>& listFragments);
+  void DoFragmentation (Ptr<const Packet> packet, const RadeepHeader& RadeepHeader, uint32_t outIfaceMtu, RadeepFragments_t& listFragments);
 
   /**
    * \brief Process a packet fragment
@@ -398,24 +468,31 @@ private:
   bool ProcessFragment (Ptr<Packet>& packet, RadeepHeader & radeepHeader, uint32_t iif);
 
   /**
-   * \brief Process the timeout for packet fragments
-   * \param key representing the packet fragments
-   * \param RadeepHeader the Radeep header of the original packet
-   * \param iif Input Interface
+   * \brief Process the timeout of the oldest fragmented packets.
+   *
+   * All the packets share the same timeout, so they expire in the order
+   * they were created.  A single event, scheduled at the expiration of the
+   * oldest packet, handles every packet expired at that time and is then
+   * scheduled again for the next one.
    */
-  void HandleFragmentsTimeout ( std::pair<uint64_t, uint32_t> key, RadeepHeader & radeepHeader, uint32_t iif);
+  void HandleFragmentsTimeout (void);
+
+  /**
+   * \brief Evict the oldest incomplete packets until the reassembly
+   * buffers fit in the memory limit.
+   */
+  void EvictFragments (void);
 
   /**
    * \brief Make a copy of the packet, add the header and invoke the TX trace callback
    * \param RadeepHeader the Radeep header that will be added to the packet
    * \param packet the packet
-   * \param Radeep the Radeep protocol
    * \param interface the interface index
    *
-   * Note: If the TracedCallback API ever is extended, we could consider
-   * to check for connected functions before adding the header
+   * Nothing is done, and in particular the packet is not copied, if no
+   * sink is connected to the Tx trace.
    */
-  void CallTxTrace (const RadeepHeader & radeepHeader, Ptr<Packet> packet, Ptr<Radeep> Radeep, uint32_t interface);
+  void CallTxTrace (const RadeepHeader & radeepHeader, Ptr<Packet> packet, uint32_t interface);
 
   /**
    * \brief Container of the Radeep Interfaces.
@@ -430,6 +507,62 @@ private:
    */
   typedef std::list<Ptr<RadeepRawSocketImpl> > SocketList;
 
+  /**
+   * \brief Indexes of the interfaces holding an address, sorted, once per
+   * address held.
+   */
+  typedef std::vector<uint32_t> AddressOwners;
+  /**
+   * \brief Container of the addresses of all interfaces, hashed by address.
+   */
+  typedef std::unordered_map<RadeepAddress, AddressOwners, RadeepAddressHash> AddressIndex;
+  /**
+   * \brief Container of the addresses of all interfaces, sorted by address.
+   */
+  typedef std::map<RadeepAddress, AddressOwners> SortedAddressIndex;
+
+  /**
+   * \brief Add an interface address to the node-wide address indexes.
+   * \param interface the interface index
+   * \param address the interface address
+   */
+  void IndexAddress (uint32_t interface, const RadeepInterfaceAddress &address);
+
+  /**
+   * \brief Remove an interface address from the node-wide address indexes.
+   * \param interface the interface index
+   * \param address the interface address
+   */
+  void UnindexAddress (uint32_t interface, const RadeepInterfaceAddress &address);
+
+  /**
+   * \brief Record that an interface holds an address.
+   * \param index the address index
+   * \param address the address
+   * \param interface the interface index
+   */
+  template <typename Index>
+  static void AddOwner (Index &index, RadeepAddress address, uint32_t interface);
+
+  /**
+   * \brief Record that an interface does not hold an address anymore.
+   * \param index the address index
+   * \param address the address
+   * \param interface the interface index
+   */
+  template <typename Index>
+  static void RemoveOwner (Index &index, RadeepAddress address, uint32_t interface);
+
+  /**
+   * \brief Check if an address belongs to the node for a packet received
+   * on an interface, according to the ES model.
+   * \param index the address index
+   * \param address the address
+   * \param iif the input interface
+   * \return true if iif, or any interface with the weak ES model, holds the address
+   */
+  bool IsOwnedBy (const AddressIndex &index, RadeepAddress address, uint32_t iif) const;
+
   /**
    * \brief Container of the Radeep L4 keys: protocol number, interface index
    */
@@ -440,13 +573,35 @@ private:
    */
   typedef std::map<L4ListKey_t, Ptr<RadeepL4Protocol> > L4List_t;
 
+  /**
+   * \brief Container of the Radeep L4 instances, indexed by protocol number.
+   */
+  typedef std::vector<Ptr<RadeepL4Protocol> > L4Demux_t;
+
+  /// Number of entries of a L4Demux_t, one per protocol number
+  static const int L4_DEMUX_SIZE = 256;
+
+  /**
+   * \brief Rebuild the demux tables from m_protocols.
+   *
+   * Called whenever a protocol is inserted or removed, so that GetProtocol
+   * is a table access.
+   */
+  void RebuildL4Demux (void);
+
   bool m_radeepForward;      //!< Forwarding packets (i.e. router mode) state.
   bool m_weakEsModel;    //!< Weak ES model state
   L4List_t m_protocols;  //!< List of transport protocol.
+  L4Demux_t m_l4Demux;   //!< Generic transport protocols, by protocol number.
+  std::vector<L4Demux_t> m_interfaceL4Demux; //!< Transport protocols by interface, then protocol number; empty if the interface has no specific protocol.
   RadeepInterfaceList m_interfaces; //!< List of Radeep interfaces.
   RadeepInterfaceReverseContainer m_reverseInterfacesContainer; //!< Container of NetDevice / Interface index associations.
+  AddressIndex m_localAddressIndex;     //!< Local addresses of all interfaces.
+  AddressIndex m_broadcastAddressIndex; //!< Broadcast addresses of all interfaces.
+  SortedAddressIndex m_prefixAddressIndex; //!< Local addresses of all interfaces, for prefix lookups.
   uint8_t m_defaultTtl;  //!< Default TTL
-  std::map<std::pair<uint64_t, uint8_t>, uint16_t> m_identification; //!< Identification (for each {src, dst, proto} tuple)
+  std::vector<uint16_t> m_identification; //!< Identification counters, indexed by {src, dst, proto} hash
+  uint32_t m_identificationBuckets;       //!< Number of identification counters
   Ptr<Node> m_node; //!< Node attached to stack.
 
   /// Trace of sent packets
@@ -473,18 +628,38 @@ private:
 
   Ptr<RadeepRoutingProtocol> m_routingProtocol; //!< Routing protocol associated with the stack
 
+  /// Routes of locally originated packets, by destination and output device
+  typedef std::unordered_map<uint64_t, Ptr<RadeepRoute> > RouteCache;
+
+  RouteCache m_routeCache;          //!< Destination cache
+  uint32_t m_routeCacheGeneration;  //!< Routing protocol generation the cache is valid for
+  uint32_t m_routeCacheSize;        //!< Maximum number of cached routes
+
+  // Built once, handed to the routing protocol for every received packet
+  RadeepRoutingProtocol::UnicastForwardCallback m_unicastForwardCallback;     //!< RadeepForward callback
+  RadeepRoutingProtocol::MulticastForwardCallback m_multicastForwardCallback; //!< RadeepMulticastForward callback
+  RadeepRoutingProtocol::LocalDeliverCallback m_localDeliverCallback;         //!< LocalDeliver callback
+  RadeepRoutingProtocol::ErrorCallback m_routeInputErrorCallback;             //!< RouteInputError callback
+
   SocketList m_sockets; //!< List of Radeep raw sockets.
+  std::vector<SocketList> m_socketsByProtocol; //!< Radeep raw sockets by protocol number; sockets with a larger protocol never match.
 
   /**
    * \brief A Set of Fragment belonging to the same packet (src, dst, identification and proto)
+   *
+   * The ranges of bytes still missing are tracked as hole descriptors
+   * (RFC 815), so that checking if the packet is entire does not require
+   * to walk the fragments.
    */
   class Fragments : public SimpleRefCount<Fragments>
   {
 public:
     /**
      * \brief Constructor.
+     * \param header the Radeep header of the first fragment received
+     * \param iif the interface the first fragment was received on
      */
-    Fragments ();
+    Fragments (const RadeepHeader &header, uint32_t iif);
 
     /**
      * \brief Destructor.
@@ -493,11 +668,18 @@ public:
 
     /**
      * \brief Add a fragment.
+     *
+     * Fragments inconsistent with the end of the packet are rejected:
+     * fragments going past the end set by the last fragment, a last
+     * fragment setting a different end, or a last fragment ending before
+     * data already received.
+     *
      * \param fragment the fragment
      * \param fragmentOffset the offset of the fragment
      * \param moreFragment the bit "More Fragment"
+     * \return false if the fragment was rejected
      */
-    void AddFragment (Ptr<Packet> fragment, uint16_t fragmentOffset, bool moreFragment);
+    bool AddFragment (Ptr<Packet> fragment, uint16_t fragmentOffset, bool moreFragment);
 
     /**
      * \brief If all fragments have been added.
@@ -517,27 +699,96 @@ public:
      */
     Ptr<Packet> GetPartialPacket () const;
 
+    /**
+     * \brief Get the number of bytes held by the fragments.
+     * \return the sum of the fragment sizes
+     */
+    uint32_t GetSize () const;
+
+    /**
+     * \return the Radeep header of the first fragment received
+     */
+    const RadeepHeader & GetHeader () const;
+
+    /**
+     * \return the interface the first fragment was received on
+     */
+    uint32_t GetInterface () const;
+
+    /**
+     * \brief Set the position of the packet in the reassembly age list.
+     * \param age the position
+     */
+    void SetAge (std::list<std::pair<uint64_t, uint32_t> >::iterator age);
+
+    /**
+     * \return the position of the packet in the reassembly age list
+     */
+    std::list<std::pair<uint64_t, uint32_t> >::iterator GetAge () const;
+
+    /**
+     * \brief Set the time at which the packet expires.
+     * \param expiration the expiration time
+     */
+    void SetExpiration (Time expiration);
+
+    /**
+     * \return the time at which the packet expires
+     */
+    Time GetExpiration () const;
+
 private:
     /**
-     * \brief True if other fragments will be sent.
+     * \brief A range of missing bytes, [first, second).
      */
-    bool m_moreFragment;
+    typedef std::pair<uint32_t, uint32_t> Hole;
+
+    /**
+     * \brief Fragments sorted by offset, fragments with the same offset
+     * being kept in arrival order.
+     */
+    typedef std::multimap<uint16_t, Ptr<Packet> > FragmentsByOffset;
+
+    /**
+     * \brief The missing ranges, sorted and disjoint.
+     */
+    std::vector<Hole> m_holes;
 
     /**
      * \brief The current fragments.
      */
-    std::list<std::pair<Ptr<Packet>, uint16_t> > m_fragments;
+    FragmentsByOffset m_fragments;
+
+    RadeepHeader m_header; //!< Radeep header of the first fragment
+    uint32_t m_iif;        //!< Interface of the first fragment
+    uint32_t m_size;       //!< Bytes held by the fragments
+    uint32_t m_end;        //!< End of the packet, set by the last fragment
+    uint32_t m_dataEnd;    //!< End of the data held by the fragments
+    std::list<std::pair<uint64_t, uint32_t> >::iterator m_age; //!< Position in the age list
+    Time m_expiration;     //!< Expiration time
 
   };
 
   /// Container of fragments, stored as pairs(src+dst addr, src+dst port) / fragment
   typedef std::map< std::pair<uint64_t, uint32_t>, Ptr<Fragments> > MapFragments_t;
-  /// Container of fragment timeout event, stored as pairs(src+dst addr, src+dst port) / EventId
-  typedef std::map< std::pair<uint64_t, uint32_t>, EventId > MapFragmentsTimers_t;
+
+  /// Keys of the packets being reassembled, oldest first
+  typedef std::list<std::pair<uint64_t, uint32_t> > FragmentsAge_t;
+
+  /**
+   * \brief Remove a packet from the reassembly buffers.
+   * \param it the packet to remove
+   */
+  void RemoveFragments (MapFragments_t::iterator it);
 
   MapFragments_t       m_fragments; //!< Fragmented packets.
   Time                 m_fragmentExpirationTimeout; //!< Expiration timeout
-  MapFragmentsTimers_t m_fragmentsTimers; //!< Expiration events.
+  EventId              m_fragmentsTimer; //!< Expiration event of the oldest fragmented packet.
+  FragmentsAge_t       m_fragmentsAge; //!< Fragmented packets, oldest first.
+  uint64_t             m_fragmentMemoryLimit; //!< Maximum bytes held for reassembly, 0 for no limit
+  uint64_t             m_fragmentBytes; //!< Bytes held for reassembly
+  uint64_t             m_fragmentEvictions; //!< Packets evicted to respect m_fragmentMemoryLimit
+  uint64_t             m_fragmentTimeouts; //!< Packets dropped on expiration
 
 };
 